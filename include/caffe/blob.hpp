@@ -262,6 +262,24 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to point to the given SyncedMemory, which
+   *        must hold at least count() elements -- used by the Net to let
+   *        activations with disjoint lifetimes take turns in one buffer.
+   *
+   * A later Reshape beyond the size of the buffer gives this Blob its own
+   * memory again.
+   */
+  void ShareDataMemory(const shared_ptr<SyncedMemory>& data);
+  /**
+   * @brief Exchange the shape and memory of this Blob with those of Blob
+   *        other, without copying -- used by data layers to hand a prefetched
+   *        batch to their top blob.
+   *
+   * Blobs sharing the memory of either Blob keep pointing at the same memory,
+   * which now belongs to the other Blob.
+   */
+  void Swap(Blob* other);
 
   bool ShapeEquals(const BlobProto& other);
 
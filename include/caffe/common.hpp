@@ -154,6 +154,12 @@ class Caffe {
   inline static void set_solver_count(int val) { Get().solver_count_ = val; }
   inline static bool root_solver() { return Get().root_solver_; }
   inline static void set_root_solver(bool val) { Get().root_solver_ = val; }
+  // Distributed training info: processes each read their own share of the
+  // training data.
+  inline static int process_count() { return Get().process_count_; }
+  inline static void set_process_count(int val) { Get().process_count_ = val; }
+  inline static int process_rank() { return Get().process_rank_; }
+  inline static void set_process_rank(int val) { Get().process_rank_ = val; }
 
  protected:
 #ifndef CPU_ONLY
@@ -165,6 +171,8 @@ class Caffe {
   Brew mode_;
   int solver_count_;
   bool root_solver_;
+  int process_count_;
+  int process_rank_;
 
  private:
   // The private constructor to avoid duplicate instantiation.
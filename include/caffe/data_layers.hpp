@@ -1,6 +1,7 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <list>
 #include <string>
 #include <utility>
 #include <vector>
@@ -15,11 +16,15 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
-#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/ring_queue.hpp"
+
+namespace boost { class mutex; }
 
 namespace caffe {
 
+class ThreadPool;
+
 /**
  * @brief Provides base for data layers that feed blobs to the Net.
  *
@@ -75,18 +80,52 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
-  // Prefetches batches (asynchronously if to GPU memory)
-  static const int PREFETCH_COUNT = 3;
 
  protected:
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<Dtype>* batch) = 0;
-
-  Batch<Dtype> prefetch_[PREFETCH_COUNT];
-  BlockingQueue<Batch<Dtype>*> prefetch_free_;
-  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  // Pops the next prefetched batch, and reports how often and how long the
+  // net has been waiting for data when it has to wait again.
+  Batch<Dtype>* next_batch();
+  // Hands one blob of a prefetched batch to a top blob on the CPU: swaps
+  // their memory if swap_prefetched is set, else copies the blob into top.
+  void OutputPrefetched(Blob<Dtype>* prefetched, Blob<Dtype>* top);
+  // Sets up the loading of batch items on num_threads threads, each with a
+  // transformer of its own. Each item is transformed with a random stream
+  // seeded for it, so that it comes out the same whichever thread loads it.
+  // The threads are started by the first LoadItems on the prefetch thread:
+  // starting them here would draw from the RNG that the fillers of the net
+  // use next.
+  void SetUpItemThreads(int num_threads);
+  // Draws the seeds of the first batch_size items of batch, and has
+  // load_items load shares of them on the item threads.
+  void LoadItems(int batch_size, Batch<Dtype>* batch);
+  // Loads items [begin, end) of batch on item thread thread_id, reseeding
+  // transformer with InitItemRand before transforming each item.
+  virtual void load_items(int begin, int end, int thread_id,
+      DataTransformer<Dtype>* transformer, Batch<Dtype>* batch) {
+    NOT_IMPLEMENTED;
+  }
+  void InitItemRand(int item_id, DataTransformer<Dtype>* transformer) {
+    transformer->InitRand(item_seeds_[item_id]);
+  }
+
+  // Prefetches data_param().prefetch() batches, or 3 for layers without a
+  // data_param (asynchronously if to GPU memory)
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
+  RingQueue<Batch<Dtype>*> prefetch_free_;
+  RingQueue<Batch<Dtype>*> prefetch_full_;
+  bool swap_prefetched_;
 
   Blob<Dtype> transformed_data_;
+
+  // The random seeds of the items of the batch being loaded
+  vector<unsigned int> item_seeds_;
+  shared_ptr<Caffe::RNG> item_seed_rng_;
+  // With more than one item thread, the pool and a transformer per thread
+  int item_threads_;
+  shared_ptr<ThreadPool> item_pool_;
+  vector<shared_ptr<DataTransformer<Dtype> > > item_transformers_;
 };
 
 template <typename Dtype>
@@ -105,8 +144,13 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual void load_batch(Batch<Dtype>* batch);
+  // Transforms the records of items [begin, end) of the batch.
+  virtual void load_items(int begin, int end, int thread_id,
+      DataTransformer<Dtype>* transformer, Batch<Dtype>* batch);
 
   DataReader reader_;
+  // The records of the items of the batch being loaded
+  vector<DataReader::Record*> records_;
 };
 
 /**
@@ -130,6 +174,13 @@ class DummyDataLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "DummyData"; }
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int MinTopBlobs() const { return 1; }
+  // Tops with a non-constant filler are refilled on every Forward.
+  virtual inline bool ForwardOnCallingThread() const {
+    for (int i = 0; i < refill_.size(); ++i) {
+      if (refill_[i]) { return true; }
+    }
+    return false;
+  }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -176,6 +227,11 @@ class HDF5DataLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
   virtual void LoadHDF5FileData(const char* filename);
+  // Moves on to the next file, or back to the first row, once the current
+  // file has been read through.
+  void LoopAround();
+  // Skips batches, e.g. those of the other processes training together.
+  void SkipBatches(int count);
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
@@ -252,9 +308,23 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  // Reads, decodes and transforms the images of items [begin, end) of the
+  // batch, adding up the time spent in each stage per thread.
+  virtual void load_items(int begin, int end, int thread_id,
+      DataTransformer<Dtype>* transformer, Batch<Dtype>* batch);
+  // Starts reading the files of the next readahead_batches batches.
+  void ReadAhead();
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  // The lines of the items of the batch being loaded, and the time each
+  // thread spent reading, decoding and transforming them
+  vector<std::pair<std::string, int> > batch_lines_;
+  vector<double> read_time_, decode_time_, trans_time_;
+  // The thread reading ahead, started on the prefetch thread, and the end of
+  // the lines read ahead so far
+  shared_ptr<ThreadPool> readahead_pool_;
+  int readahead_id_;
 };
 
 /**
@@ -322,10 +392,15 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int ExactNumTopBlobs() const { return 2; }
 
  protected:
-  virtual unsigned int PrefetchRand();
   virtual void load_batch(Batch<Dtype>* batch);
+  // Samples, loads and warps the windows [begin, end) of the batch, each
+  // with a random stream seeded for it, adding up the time spent per thread.
+  virtual void load_items(int begin, int end, int thread_id,
+      DataTransformer<Dtype>* transformer, Batch<Dtype>* batch);
+  // Returns the decoded image, from the decoded image cache if it is there;
+  // an empty cv::Mat if the image cannot be read.
+  cv::Mat LoadImage(int image_index);
 
-  shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
   enum WindowField { IMAGE_INDEX, LABEL, OVERLAP, X1, Y1, X2, Y2, NUM };
   vector<vector<float> > fg_windows_;
@@ -336,6 +411,18 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
   bool has_mean_values_;
   bool cache_images_;
   vector<std::pair<std::string, Datum > > image_database_cache_;
+  // The decoded image cache, most recently used first, with the position of
+  // each image index in it. Shared by the workers under the mutex.
+  typedef std::list<std::pair<int, shared_ptr<cv::Mat> > > DecodedCache;
+  DecodedCache decoded_cache_;
+  map<int, DecodedCache::iterator> decoded_cache_index_;
+  size_t decoded_cache_capacity_;
+  size_t decoded_cache_bytes_;
+  int decoded_cache_hits_;
+  int decoded_cache_misses_;
+  shared_ptr<boost::mutex> decoded_cache_mutex_;
+  // The time each thread spent reading and warping windows
+  vector<double> read_time_, trans_time_;
 };
 
 }  // namespace caffe
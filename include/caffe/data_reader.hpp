@@ -9,6 +9,7 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/ring_queue.hpp"
 
 namespace caffe {
 
@@ -18,17 +19,33 @@ namespace caffe {
  * are running in parallel, e.g. for multi-GPU training. This makes sure
  * databases are read sequentially, and that each solver accesses a different
  * subset of the database. Data is distributed to solvers in a round-robin
- * way to keep parallel training deterministic.
+ * way to keep parallel training deterministic. With reader_threads > 1, the
+ * records are parsed by that many threads, each reading every n-th record,
+ * and still handed out in database order. When training is distributed
+ * over several processes, each one keeps its own solvers' turns of the
+ * round-robin and skips the others'.
  */
 class DataReader {
  public:
+  /**
+   * @brief A Datum handed from the reader to a data layer. The uint8 pixels
+   * of sources whose values stay mapped while they are read, i.e. LMDB, are
+   * not copied into the Datum: pixels points at them in the map instead, and
+   * datum.data() is empty. Otherwise pixels is NULL.
+   */
+  struct Record {
+    Record() : pixels(NULL) { }
+    Datum datum;
+    const char* pixels;
+  };
+
   explicit DataReader(const LayerParameter& param);
   ~DataReader();
 
-  inline BlockingQueue<Datum*>& free() const {
+  inline RingQueue<Record*>& free() const {
     return queue_pair_->free_;
   }
-  inline BlockingQueue<Datum*>& full() const {
+  inline RingQueue<Record*>& full() const {
     return queue_pair_->full_;
   }
 
@@ -39,12 +56,31 @@ class DataReader {
     explicit QueuePair(int size);
     ~QueuePair();
 
-    BlockingQueue<Datum*> free_;
-    BlockingQueue<Datum*> full_;
+    RingQueue<Record*> free_;
+    RingQueue<Record*> full_;
 
   DISABLE_COPY_AND_ASSIGN(QueuePair);
   };
 
+  // Reads every num_shards-th record of a source, starting at its index, for
+  // a body that parses records on more than one thread
+  class Shard : public InternalThread {
+   public:
+    Shard(db::Cursor* cursor, int index, int num_shards, int size);
+    virtual ~Shard();
+
+    QueuePair records_;
+
+   protected:
+    void InternalThreadEntry();
+
+    shared_ptr<db::Cursor> cursor_;
+    const int index_;
+    const int num_shards_;
+
+  DISABLE_COPY_AND_ASSIGN(Shard);
+  };
+
   // A single body is created per source
   class Body : public InternalThread {
    public:
@@ -54,9 +90,13 @@ class DataReader {
    protected:
     void InternalThreadEntry();
     void read_one(db::Cursor* cursor, QueuePair* qp);
+    void skip(db::Cursor* cursor, int count);
 
     const LayerParameter param_;
     BlockingQueue<shared_ptr<QueuePair> > new_queue_pairs_;
+    // Records are taken from the shards in turn, if there are any
+    vector<shared_ptr<Shard> > shards_;
+    int next_shard_;
 
     friend class DataReader;
 
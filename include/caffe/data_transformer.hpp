@@ -24,6 +24,11 @@ class DataTransformer {
    *    transformation.
    */
   void InitRand();
+  /**
+   * @brief Same, seeding the random number generations with seed, e.g. to
+   *    give each item of a batch its own stream.
+   */
+  void InitRand(unsigned int seed);
 
   /**
    * @brief Applies the transformation defined in the data layer's
@@ -37,6 +42,21 @@ class DataTransformer {
    */
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Applies the transformation defined in the data layer's
+   * transform_param block to a Datum whose uint8 pixels are held outside of
+   * it, e.g. in a database's memory map.
+   *
+   * @param datum
+   *    Datum giving the shape of the data.
+   * @param pixels
+   *    The uint8 pixels of the datum, or NULL to use the datum's own data.
+   * @param transformed_blob
+   *    This is destination blob.
+   */
+  void Transform(const Datum& datum, const char* pixels,
+                 Blob<Dtype>* transformed_blob);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
@@ -134,7 +154,9 @@ class DataTransformer {
    */
   virtual int Rand(int n);
 
-  void Transform(const Datum& datum, Dtype* transformed_data);
+  // pixels are the uint8 data of the datum, or NULL if it holds float_data.
+  void Transform(const Datum& datum, const char* pixels,
+                 Dtype* transformed_data);
   // Tranformation parameters
   TransformationParameter param_;
 
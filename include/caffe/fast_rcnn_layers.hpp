@@ -8,17 +8,90 @@
 #ifndef CAFFE_FAST_RCNN_LAYERS_HPP_
 #define CAFFE_FAST_RCNN_LAYERS_HPP_
 
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/loss_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
 
 namespace caffe {
 
+/* ROIDataLayer - Fast R-CNN minibatch sampling
+ *
+ * Prefetches image-centric minibatches: ims_per_batch images, each resized
+ * to a random scale, and batch_size / ims_per_batch of their ROIs, with up to
+ * fg_fraction of them foreground. The tops are
+ *   data          (ims_per_batch, 3, H, W), the images zero padded to the
+ *                 largest of the batch, with transform_param mean and scale
+ *   rois          (R, 5): image index in the batch, x1, y1, x2, y2
+ *   labels        (R)
+ *   bbox_targets  (R, 4 * num_classes): the ROI's targets at its label
+ *   bbox_weights  (R, 4 * num_classes): 1 where bbox_targets is set
+ * with the last two optional. transform_param mirror flips images at random.
+ *
+ * The roidb file lists, like the window file of WindowDataLayer,
+ *   # image_index
+ *   img_path
+ *   num_rois
+ *   label overlap x1 y1 x2 y2 tx ty tw th
+ * where overlap is the ROI's largest overlap with a ground truth box, label
+ * the class of that box and t its normalized regression targets.
+*/
+template <typename Dtype>
+class ROIDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit ROIDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param) {}
+  virtual ~ROIDataLayer();
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "ROIData"; }
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int MinTopBlobs() const { return 3; }
+  virtual inline int MaxTopBlobs() const { return 5; }
+
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) { Forward_cpu(bottom, top); }
+
+ protected:
+  virtual void load_batch(Batch<Dtype>* batch);
+  virtual void ShuffleImages();
+  virtual unsigned int PrefetchRand();
+  /// Append the ROIs of one image of the batch, sampled at random.
+  void SampleROIs(int image_id, int batch_index, Dtype im_scale,
+      bool do_mirror, int image_width, vector<Dtype>* rois,
+      vector<Dtype>* labels, vector<Dtype>* bbox_targets);
+  /// The index of a batch in this->prefetch_, and of its extra blobs.
+  int BatchIndex(const Batch<Dtype>* batch) const;
+
+  enum ROIField { LABEL, OVERLAP, X1, Y1, X2, Y2, TX, TY, TW, TH, NUM };
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  vector<std::string> image_paths_;
+  /// For each image, NUM fields per ROI.
+  vector<vector<float> > image_rois_;
+  vector<int> image_order_;
+  int image_cursor_;
+  vector<Dtype> mean_values_;
+  /// The rois, bbox_targets and bbox_weights of each batch of this->prefetch_
+  vector<shared_ptr<Blob<Dtype> > > prefetch_rois_;
+  vector<shared_ptr<Blob<Dtype> > > prefetch_bbox_targets_;
+  vector<shared_ptr<Blob<Dtype> > > prefetch_bbox_weights_;
+};
+
 /* ROIPoolingLayer - Region of Interest Pooling Layer
+ *
+ * MAX pools over bins quantized to the feature map grid. ALIGN averages
+ * sampling_ratio x sampling_ratio bilinear samples per bin without any
+ * rounding; the sample positions and weights are computed once per ROI and
+ * shared by all channels in both passes. With layout NHWC the features and
+ * the output are channel-last (CPU only); the ROIs are unaffected.
 */
 template <typename Dtype>
 class ROIPoolingLayer : public Layer<Dtype> {
@@ -47,6 +120,13 @@ class ROIPoolingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  void AlignForward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void AlignBackward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  /// Fill sample_index_ and sample_weight_ for the ROIs in rois.
+  void ComputeSamplingTables(const Blob<Dtype>& rois);
+
   int channels_;
   int height_;
   int width_;
@@ -54,6 +134,11 @@ class ROIPoolingLayer : public Layer<Dtype> {
   int pooled_width_;
   Dtype spatial_scale_;
   Blob<int> max_idx_;
+  /// ALIGN: per (ROI, bin), the plane offsets of the four neighbours of
+  /// every sample and their bilinear weights, pre-divided by the sample count
+  int sampling_ratio_;
+  Blob<int> sample_index_;
+  Blob<Dtype> sample_weight_;
 };
 
 template <typename Dtype>
@@ -93,7 +178,6 @@ class SmoothL1LossLayer : public LossLayer<Dtype> {
 
   Blob<Dtype> diff_;
   Blob<Dtype> errors_;
-  Blob<Dtype> ones_;
   bool has_weights_;
   Dtype sigma2_;
 };
@@ -294,6 +294,27 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Return whether the top blobs take over the data of bottom blob 0
+   *        (see Blob::ShareData) instead of holding values of their own.
+   *
+   * The net keeps the memory of such a bottom alive for as long as any of
+   * the tops is used when it reuses activation memory.
+   */
+  virtual inline bool SharesBottomData() const { return false; }
+
+  /**
+   * @brief Return whether Forward has to run on the thread that calls
+   *        Net::Forward.
+   *
+   * A parallel forward pass runs such layers there, in layer order, instead
+   * of on its workers. This is the case for layers that draw from the Caffe
+   * random number generator, which belongs to the calling thread, so that
+   * they draw the numbers a serial pass would, and for layers that need a
+   * lock the caller holds, such as the Python GIL.
+   */
+  virtual inline bool ForwardOnCallingThread() const { return false; }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -14,6 +14,9 @@
 
 namespace caffe {
 
+class ThreadPool;
+template <typename Dtype> class CPUParams;
+
 /**
  * @brief Connects Layer%s together into a directed acyclic graph (DAG)
  *        specified by a NetParameter.
@@ -165,6 +168,26 @@ class Net {
   inline const vector<Blob<Dtype>*>& learnable_params() const {
     return learnable_params_;
   }
+  /// @brief returns the id of the layer owning each learnable param, the
+  ///        last one backward goes through to compute its diff
+  inline const vector<int>& learnable_param_layer_ids() const {
+    return learnable_param_layer_ids_;
+  }
+  /**
+   * @brief With flat_params, the learnable params lie back to back in one
+   *        host array of flat_params_count() elements, and their diffs in
+   *        another. These bring every learnable param to host memory and
+   *        return the arrays, or NULL without flat_params.
+   */
+  inline bool has_flat_params() const { return flat_params_.get() != NULL; }
+  /// @brief Lays the learnable params out as with flat_params, if they are
+  ///        not already. Net::Init calls this for flat_params.
+  void FlattenParams();
+  size_t flat_params_count() const;
+  const Dtype* flat_params_cpu_data() const;
+  const Dtype* flat_params_cpu_diff() const;
+  Dtype* mutable_flat_params_cpu_data();
+  Dtype* mutable_flat_params_cpu_diff();
   /// @brief returns the learnable parameter learning rate multipliers
   inline const vector<float>& params_lr() const { return params_lr_; }
   inline const vector<bool>& has_params_lr() const { return has_params_lr_; }
@@ -201,6 +224,24 @@ class Net {
 
   void set_debug_info(const bool value) { debug_info_ = value; }
 
+  /**
+   * @brief Callbacks run by BackwardFromTo once each layer is done, deepest
+   *        layer first. When layer_id is done, the diffs of the learnable
+   *        params it owns are final for this pass, so that e.g. gradient
+   *        communication can start while lower layers are still running.
+   */
+  class Callback {
+   protected:
+    virtual void on_backward_done(int layer_id) = 0;
+
+    template <typename T>
+    friend class Net;
+  };
+  const vector<Callback*>& callbacks() const { return callbacks_; }
+  void add_callback(Callback* value) {
+    callbacks_.push_back(value);
+  }
+
   // Helpers for Init.
   /**
    * @brief Remove layers that the user specified should be excluded given the current
@@ -226,6 +267,26 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /**
+   * @brief Let activations whose lifetimes do not overlap share memory
+   *        (see NetParameter.reuse_activations).
+   */
+  void PlanActivationMemory();
+
+  /**
+   * @brief Find, for each layer, the earlier layers it has to wait for in
+   *        Forward (see NetParameter.parallel_forward).
+   */
+  void BuildForwardSchedule();
+  /// @brief ForwardFromTo on the worker pool, following the schedule.
+  Dtype ParallelForwardFromTo(int start, int end);
+  /// @brief The progress of a parallel forward pass, shared by its tasks.
+  class ForwardState;
+  /// @brief Run one layer of a parallel forward pass and queue the layers it
+  ///        leaves ready.
+  void ParallelForwardLayer(int layer_id, int start, int end,
+      ForwardState* state);
+
   /// @brief Helper for displaying debug info in Forward about input Blobs.
   void InputDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Forward.
@@ -282,16 +343,33 @@ class Net {
    * and learnable_params_[learnable_param_ids_[i]] gives its owner.
    */
   vector<int> learnable_param_ids_;
+  /// the id of the layer owning each of learnable_params_
+  vector<int> learnable_param_layer_ids_;
   /// the learning rate multipliers for learnable_params_
   vector<float> params_lr_;
   vector<bool> has_params_lr_;
   /// the weight decay multipliers for learnable_params_
   vector<float> params_weight_decay_;
   vector<bool> has_params_decay_;
+  /// The contiguous memory of learnable_params_ with flat_params
+  shared_ptr<CPUParams<Dtype> > flat_params_;
+  /// Callbacks run by BackwardFromTo
+  vector<Callback*> callbacks_;
   /// The bytes of memory used by this net
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether activations share memory, the shared buffers, and the index
+  /// into activation_buffers_ of each blob (-1 if it has its own memory).
+  bool reuse_activations_;
+  vector<shared_ptr<SyncedMemory> > activation_buffers_;
+  vector<int> blob_activation_buffers_;
+  /// Whether Forward runs independent layers concurrently, the worker pool,
+  /// and for each layer the layers it waits for and the layers waiting on it.
+  bool parallel_forward_;
+  shared_ptr<ThreadPool> forward_pool_;
+  vector<vector<int> > layer_dependencies_;
+  vector<vector<int> > layer_dependents_;
   /// The root net that actually holds the shared layers in data parallelism
   const Net* const root_net_;
   DISABLE_COPY_AND_ASSIGN(Net);
@@ -3,16 +3,20 @@
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
-#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/ring_queue.hpp"
+#include "caffe/util/socket.hpp"
 
 namespace caffe {
 
@@ -23,6 +27,7 @@ template<typename Dtype>
 class Params {
  public:
   explicit Params(shared_ptr<Solver<Dtype> > root_solver);
+  explicit Params(const vector<Blob<Dtype>*>& params);
   virtual ~Params() {
   }
 
@@ -59,6 +64,22 @@ class GPUParams : public Params<Dtype> {
   using Params<Dtype>::diff_;
 };
 
+// Params stored in host memory, backing the learnable parameters of nets
+// created with flat_params.
+template<typename Dtype>
+class CPUParams : public Params<Dtype> {
+ public:
+  explicit CPUParams(const vector<Blob<Dtype>*>& params);
+  virtual ~CPUParams();
+
+  void configure(const vector<Blob<Dtype>*>& params) const;
+
+ protected:
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
 class DevicePair {
  public:
   DevicePair(int parent, int device)
@@ -80,10 +101,13 @@ class DevicePair {
   int device_;
 };
 
-// Synchronous data parallelism using map-reduce between local GPUs.
+// Synchronous data parallelism using map-reduce between local GPUs. The
+// gradients of each layer go up the tree as soon as backward is done with it,
+// on a stream of their own, so that the deepest layers are reduced while the
+// lower ones are still backpropagating.
 template<typename Dtype>
 class P2PSync : public GPUParams<Dtype>, public Solver<Dtype>::Callback,
-    public InternalThread {
+    public Net<Dtype>::Callback, public InternalThread {
  public:
   explicit P2PSync(shared_ptr<Solver<Dtype> > root_solver,
                    P2PSync<Dtype>* parent, const SolverParameter& param);
@@ -97,22 +121,127 @@ class P2PSync : public GPUParams<Dtype>, public Solver<Dtype>::Callback,
 
  protected:
   void on_start();
+  void on_backward_done(int layer_id);
   void on_gradients_ready();
 
   void InternalThreadEntry();
 
   P2PSync<Dtype>* parent_;
   vector<P2PSync<Dtype>*> children_;
-  BlockingQueue<P2PSync<Dtype>*> queue_;
+  RingQueue<P2PSync<Dtype>*> queue_;
   const int initial_iter_;
   Dtype* parent_grads_;
   shared_ptr<Solver<Dtype> > solver_;
 
+  // Range of the diff buffer holding the params each layer owns
+  vector<pair<size_t, size_t> > layer_ranges_;
+  // Backward passes each layer is done with, out of iter_size
+  vector<int> layer_passes_;
+  // Layers reduced this iteration, and received from each child
+  int reduced_layers_;
+  vector<int> child_layers_;
+#ifndef CPU_ONLY
+  // Copies gradients to the parent alongside backward
+  cudaStream_t stream_;
+  // Marks the end of the last layer reduced, and of each layer's copy
+  cudaEvent_t reduced_;
+  vector<cudaEvent_t> sent_;
+#endif
+
   using Params<Dtype>::size_;
   using Params<Dtype>::data_;
   using Params<Dtype>::diff_;
 };
 
+// Synchronous data parallelism between solver threads of one host. Each
+// thread trains a replica of the net on its share of the data, and the
+// gradients are summed up a binary tree in host memory. The nets are laid out
+// with flat_params so that weights and gradients move in one copy each.
+template<typename Dtype>
+class CPUSync : public Solver<Dtype>::Callback, public InternalThread {
+ public:
+  explicit CPUSync(shared_ptr<Solver<Dtype> > root_solver,
+                   CPUSync<Dtype>* parent, int rank);
+  virtual ~CPUSync();
+
+  inline const shared_ptr<Solver<Dtype> >& solver() const {
+    return solver_;
+  }
+
+  // Trains on num_threads threads, this one included. With pin_threads, each
+  // thread is pinned to its own range of cores, which keeps it on one NUMA
+  // node when the node count divides the thread count.
+  void run(int num_threads, bool pin_threads = false);
+
+ protected:
+  void on_start();
+  void on_gradients_ready();
+
+  void InternalThreadEntry();
+  void SetUpThread();
+
+  CPUSync<Dtype>* parent_;
+  vector<CPUSync<Dtype>*> children_;
+  RingQueue<CPUSync<Dtype>*> queue_;
+  const int initial_iter_;
+  const int rank_;
+  bool pin_threads_;
+  size_t size_;
+  // Where this solver leaves its gradients for the parent to sum
+  Dtype* parent_grads_;
+  shared_ptr<Solver<Dtype> > solver_;
+};
+
+// Synchronous data parallelism between processes, on one host or several.
+// Each process trains a replica of the net on its share of the data, and the
+// gradients are averaged with a ring all-reduce over sockets. The flat diff
+// array is cut into buckets of whole params, which are reduced on a thread of
+// their own as soon as backward is done with them, deepest first, so that
+// communication overlaps the backward pass of the lower layers.
+template<typename Dtype>
+class SocketSync : public Solver<Dtype>::Callback,
+    public Net<Dtype>::Callback, public InternalThread {
+ public:
+  // addresses lists the Socket addresses of every process, in rank order.
+  // Buckets hold at least bucket_size values, unless the net has fewer.
+  explicit SocketSync(shared_ptr<Solver<Dtype> > solver, int rank,
+                      const vector<string>& addresses,
+                      size_t bucket_size = 1 << 20);
+  virtual ~SocketSync();
+
+  inline const shared_ptr<Solver<Dtype> >& solver() const {
+    return solver_;
+  }
+
+  // Connects the ring, starts from the weights of rank 0, and trains.
+  void run();
+
+ protected:
+  void on_start();
+  void on_backward_done(int layer_id);
+  void on_gradients_ready();
+
+  void InternalThreadEntry();
+  // Sums a bucket over the ring, leaving the total on every process
+  void AllReduce(int bucket);
+
+  shared_ptr<Solver<Dtype> > solver_;
+  const int rank_;
+  const vector<string> addresses_;
+  // Ranges of the flat diff array, and the buckets each layer completes
+  vector<pair<size_t, size_t> > buckets_;
+  vector<vector<int> > layer_buckets_;
+  // Backward passes each bucket is done with, out of iter_size
+  vector<int> bucket_passes_;
+  // Buckets ready to reduce, and reduced
+  RingQueue<int> ready_;
+  RingQueue<int> reduced_;
+  shared_ptr<Socket> next_;
+  shared_ptr<Socket> previous_;
+  vector<Dtype> received_;
+  Dtype* diff_;
+};
+
 }  // namespace caffe
 
 #endif
@@ -32,6 +32,8 @@ class PythonLayer : public Layer<Dtype> {
   }
 
   virtual inline const char* type() const { return "Python"; }
+  // Forward needs the GIL, which the thread calling the net holds.
+  virtual inline bool ForwardOnCallingThread() const { return true; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
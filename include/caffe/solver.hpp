@@ -168,6 +168,17 @@ class SGDSolver : public Solver<Dtype> {
   virtual void Regularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
   virtual void ClipGradients();
+  // Applies the update in CPU mode with FusedUpdate, on chunks of the
+  // parameters spread across OpenMP threads.
+  void ApplyFusedUpdate(Dtype rate);
+  // Normalizes, regularizes and computes the update value of elements
+  // [begin, end) of a parameter, then subtracts it from the weights, going
+  // over each array once. Solvers overriding ComputeUpdateValue override
+  // this to match.
+  virtual void FusedUpdate(int param_id, Dtype rate, int begin, int end);
+  // Whether this is one of the built-in solvers, whose FusedUpdate matches
+  // their separate steps. Other subclasses may override only some of these.
+  bool HasFusedUpdate() const;
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
   virtual void SnapshotSolverStateToHDF5(const string& model_filename);
@@ -178,6 +189,9 @@ class SGDSolver : public Solver<Dtype> {
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  // CPU pointers to the parameters and history_ for FusedUpdate, gathered
+  // before the threads start so that they do not touch the synced memory.
+  vector<Dtype*> fused_data_, fused_diff_, fused_history_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -192,6 +206,7 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdate(int param_id, Dtype rate, int begin, int end);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -206,6 +221,7 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdate(int param_id, Dtype rate, int begin, int end);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -225,6 +241,7 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdate(int param_id, Dtype rate, int begin, int end);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -248,6 +265,7 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdate(int param_id, Dtype rate, int begin, int end);
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
 };
@@ -271,6 +289,7 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void FusedUpdate(int param_id, Dtype rate, int begin, int end);
 
   DISABLE_COPY_AND_ASSIGN(AdamSolver);
 };
@@ -18,8 +18,24 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  /**
+   * @brief Points data at the current value without copying it, when the
+   *        backend can. The default copies the value into the cursor.
+   *
+   * @return whether the view stays valid after the cursor moves, for as long
+   *         as the cursor lives, rather than only until the next move.
+   */
+  virtual bool value_view(const char** data, size_t* size) {
+    value_ = value();
+    *data = value_.data();
+    *size = value_.size();
+    return false;
+  }
   virtual bool valid() = 0;
 
+ private:
+  string value_;
+
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
 
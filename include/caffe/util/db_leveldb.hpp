@@ -19,6 +19,12 @@ class LevelDBCursor : public Cursor {
   virtual void Next() { iter_->Next(); }
   virtual string key() { return iter_->key().ToString(); }
   virtual string value() { return iter_->value().ToString(); }
+  virtual bool value_view(const char** data, size_t* size) {
+    leveldb::Slice value = iter_->value();
+    *data = value.data();
+    *size = value.size();
+    return false;
+  }
   virtual bool valid() { return iter_->Valid(); }
 
  private:
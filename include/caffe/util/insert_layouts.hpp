@@ -0,0 +1,40 @@
+#ifndef _CAFFE_UTIL_INSERT_LAYOUTS_HPP_
+#define _CAFFE_UTIL_INSERT_LAYOUTS_HPP_
+
+#include <string>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters, marking every layer that can work on channel-last
+// (NHWC) blobs as such when param.layout() is NHWC, and adding LayoutLayers
+// to convert between the orders where needed. Blobs keep their names in NCHW
+// order, so inputs, outputs and the layers that only know NCHW see no change;
+// the channel-last copies are named by ChannelLastBlobName.
+void InsertLayouts(const NetParameter& param, NetParameter* param_layout);
+
+// Whether the layer given by layer_param has a channel-last implementation.
+bool SupportsChannelLast(const LayerParameter& layer_param);
+
+// Whether bottom bottom_idx of a channel-last layer is an activation in
+// channel-last order (as opposed to e.g. the boxes of an ROIPoolingLayer).
+bool IsChannelLastBottom(const LayerParameter& layer_param,
+    const int bottom_idx);
+
+// Configure a LayoutLayer converting blob_name to (layout NHWC) or from
+// (layout NCHW) its channel-last copy channel_last_blob_name.
+void ConfigureLayoutLayer(const string& layer_name, const string& blob_name,
+    const string& channel_last_blob_name, const DataLayout layout,
+    LayerParameter* layout_layer_param);
+
+string LayoutLayerName(const string& layer_name, const string& blob_name,
+    const DataLayout layout);
+
+// The name of a channel-last copy of blob_name; version counts the copies
+// made after NCHW-only layers changed the blob in place.
+string ChannelLastBlobName(const string& blob_name, const int version = 0);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_INSERT_LAYOUTS_HPP_
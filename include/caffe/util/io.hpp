@@ -131,6 +131,10 @@ cv::Mat ReadImageToCVMat(const string& filename,
 
 cv::Mat ReadImageToCVMat(const string& filename);
 
+// Asks the OS to read the file into its cache in the background, where
+// supported. Returns false if the file cannot be opened.
+bool ReadAheadFile(const string& filename);
+
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum);
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color);
 
@@ -0,0 +1,75 @@
+#ifndef CAFFE_UTIL_RING_QUEUE_HPP_
+#define CAFFE_UTIL_RING_QUEUE_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A bounded queue for handing items between threads, e.g. batches
+ * between a prefetch thread and its data layer.
+ *
+ * Pushes and pops are lock-free, and safe from any number of producer and
+ * consumer threads. Only push() on a full queue and pop() or peek() on an
+ * empty one block: they retry spin_count times, yielding in between, then
+ * park on a condition variable, which is an interruption point like in
+ * BlockingQueue. The time spent blocked is counted, to tell how often and
+ * for how long consumers starve, or producers are held up.
+ */
+template<typename T>
+class RingQueue {
+ public:
+  /// The capacity is rounded up to a power of two, and at least 2.
+  explicit RingQueue(size_t capacity, int spin_count = 0);
+
+  void push(const T& t);
+
+  bool try_push(const T& t);
+
+  bool try_pop(T* t);
+
+  T pop();
+
+  // Return element without removing it. Only meaningful with a single
+  // consumer, as another one may pop the element meanwhile.
+  bool try_peek(T* t);
+
+  T peek();
+
+  size_t size() const;
+
+  inline size_t capacity() const { return cells_.size(); }
+
+  // Number of pops or peeks that found the queue empty and had to wait, and
+  // their total waiting time in milliseconds.
+  size_t pop_waits() const;
+  double pop_wait_time() const;
+  // Same for pushes that found the queue full.
+  size_t push_waits() const;
+  double push_wait_time() const;
+
+ protected:
+  bool enqueue(const T& t);
+  bool dequeue(T* t);
+  bool front(T* t);
+  // Wakes the threads parked on the queue, if any
+  void notify();
+
+  /**
+   Move synchronization fields out instead of including boost/thread.hpp
+   and boost/atomic.hpp, as for BlockingQueue.
+   */
+  class sync;
+
+  std::vector<T> cells_;
+  const int spin_count_;
+  shared_ptr<sync> sync_;
+
+DISABLE_COPY_AND_ASSIGN(RingQueue);
+};
+
+}  // namespace caffe
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef CAFFE_UTIL_SOCKET_HPP_
+#define CAFFE_UTIL_SOCKET_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A stream socket between training processes, over TCP for
+ * "host:port" addresses, or over a Unix domain socket for "unix:path" ones.
+ *
+ * Failures are fatal, as a process cannot train on without its peers.
+ */
+class Socket {
+ public:
+  ~Socket();
+
+  // Listens on the port or path of an address, for peers to Connect to.
+  static shared_ptr<Socket> Listen(const string& address);
+  // Accepts the next connection to a listening socket.
+  shared_ptr<Socket> Accept();
+  // Connects to an address, retrying until a peer listens on it, for up to
+  // timeout_ms milliseconds.
+  static shared_ptr<Socket> Connect(const string& address, int timeout_ms);
+
+  void Send(const void* data, size_t size);
+  void Receive(void* data, size_t size);
+  // Sends to one socket while receiving from another, so that peers which
+  // all send at once, e.g. around a ring, do not wait on each other.
+  static void SendReceive(Socket* to, const void* out, size_t out_size,
+      Socket* from, void* in, size_t in_size);
+
+ protected:
+  explicit Socket(int fd, const string& path = "");
+
+  const int fd_;
+  // The path of a listening Unix domain socket, removed along with it
+  const string path_;
+
+  DISABLE_COPY_AND_ASSIGN(Socket);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SOCKET_HPP_
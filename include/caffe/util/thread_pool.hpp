@@ -0,0 +1,57 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A fixed set of worker threads running tasks from a shared queue.
+ *
+ * Workers are InternalThreads, so they start with the Caffe mode, device and
+ * solver state of the thread that created the pool. Tasks run in no
+ * particular order; callers synchronize on their completion themselves.
+ */
+class ThreadPool {
+ public:
+  typedef boost::function<void()> Task;
+
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  void Enqueue(const Task& task);
+  /**
+   * @brief Run the tasks on the pool and return once all of them are done.
+   *
+   * The wait is not an interruption point, so the tasks may safely refer to
+   * the caller's stack.
+   */
+  void Run(const vector<Task>& tasks);
+  inline int size() const { return workers_.size(); }
+
+ protected:
+  class Worker : public InternalThread {
+   public:
+    explicit Worker(BlockingQueue<Task>* tasks) : tasks_(tasks) {}
+    virtual ~Worker() { StopInternalThread(); }
+
+   protected:
+    void InternalThreadEntry();
+
+    BlockingQueue<Task>* tasks_;
+  };
+
+  BlockingQueue<Task> tasks_;
+  vector<shared_ptr<Worker> > workers_;
+
+DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
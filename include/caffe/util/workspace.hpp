@@ -0,0 +1,40 @@
+#ifndef CAFFE_UTIL_WORKSPACE_HPP_
+#define CAFFE_UTIL_WORKSPACE_HPP_
+
+#include <boost/thread/tss.hpp>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Scratch memory shared by all the layers that run on a thread, such
+ *        as the im2col buffers of the convolution layers.
+ *
+ * Layers on one thread run one at a time and only need their scratch space
+ * within a single Forward or Backward call, so one buffer sized for the
+ * largest request serves all of them. Every thread has a buffer of its own,
+ * so nets running on separate threads never share scratch data.
+ */
+template <typename Dtype>
+class Workspace {
+ public:
+  /**
+   * @brief Returns the calling thread's buffer, grown to hold at least count
+   *        values.
+   *
+   * Growing the buffer discards its contents and invalidates pointers into
+   * it, so callers must not hold on to them across calls that may grow it.
+   */
+  static Blob<Dtype>* Get(const int count);
+  /// @brief Frees the calling thread's buffer.
+  static void Release();
+
+ private:
+  static boost::thread_specific_ptr<Blob<Dtype> > buffer_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WORKSPACE_HPP_
@@ -46,6 +46,24 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
       weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // Accumulates the weight gradient of all num_ images into weights. With
+  // parallel_batch_ the images are split across threads, each summing into a
+  // private copy of the gradient, and the copies are added in a fixed order.
+  void weight_cpu_gemm_batch(const Dtype* input, const Dtype* output,
+      Dtype* weights);
+
+  // Counterparts of the helpers above for channel-last (NHWC) blobs, where
+  // each image is a (height x width) x channels matrix. The filters are taken
+  // in num_output x kernel_h x kernel_w x channels order, as kept in
+  // channel_last_weight_. Only for ungrouped convolution.
+  void forward_cpu_gemm_channel_last(const Dtype* input, const Dtype* weights,
+      Dtype* output);
+  void forward_cpu_bias_channel_last(Dtype* output, const Dtype* bias);
+  void backward_cpu_gemm_channel_last(const Dtype* output,
+      const Dtype* weights, Dtype* input);
+  void weight_cpu_gemm_channel_last(const Dtype* input, const Dtype* output,
+      Dtype* weights);
+  void backward_cpu_bias_channel_last(Dtype* bias, const Dtype* input);
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -75,6 +93,11 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int height_out_, width_out_;
   bool bias_term_;
   bool is_1x1_;
+  // Whether the CPU helpers run the images of the batch in parallel.
+  bool parallel_batch_;
+  // The filters (data) and their gradient (diff) in channel-last order; only
+  // used when the layout is NHWC.
+  Blob<Dtype> channel_last_weight_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -86,6 +109,17 @@ class BaseConvolutionLayer : public Layer<Dtype> {
     col2im_cpu(col_buff, conv_in_channels_, conv_in_height_, conv_in_width_,
         kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_, data);
   }
+  inline void conv_im2col_channel_last_cpu(const Dtype* data,
+      Dtype* col_buff) {
+    im2col_nhwc_cpu(data, conv_in_channels_, conv_in_height_, conv_in_width_,
+        kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_, col_buff);
+  }
+  inline void conv_col2im_channel_last_cpu(const Dtype* col_buff,
+      Dtype* data) {
+    col2im_nhwc_cpu(col_buff, conv_in_channels_, conv_in_height_,
+        conv_in_width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+        stride_w_, data);
+  }
 #ifndef CPU_ONLY
   inline void conv_im2col_gpu(const Dtype* data, Dtype* col_buff) {
     im2col_gpu(data, conv_in_channels_, conv_in_height_, conv_in_width_,
@@ -107,7 +141,12 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int col_offset_;
   int output_offset_;
 
-  Blob<Dtype> col_buffer_;
+  // The im2col buffer is borrowed from the thread's Workspace for the length
+  // of each helper call rather than owned by the layer.
+  Blob<Dtype>* col_buffer();
+  int col_buffer_count_;
+  // Per-thread partial weight gradients for weight_cpu_gemm_batch.
+  Blob<Dtype> weight_diff_buffer_;
   Blob<Dtype> bias_multiplier_;
 };
 
@@ -155,8 +194,9 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  first group and input channels 3-4 and output channels 5-8 into the second
    *  group.
    *  - bias_term (\b optional, default true). Whether to have a bias.
-   *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-   *    kernels + stream parallelism) engines.
+   *  - engine: convolution has CAFFE (matrix multiplication), CUDNN (library
+   *    kernels + stream parallelism) and WINOGRAD (CPU minimal filtering for
+   *    3x3 filters) engines.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
@@ -174,6 +214,56 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
   virtual void compute_output_shape();
+
+  /// @brief Convolution of channel-last (NHWC) blobs, CPU only.
+  void ChannelLastForward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void ChannelLastBackward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+};
+
+/**
+ * @brief Winograd implementation of ConvolutionLayer for the CPU.
+ *        Falls back to ConvolutionLayer for the shapes it does not cover and
+ *        for GPU mode.
+ *
+ * Ungrouped stride 1 3x3 convolutions are computed with the minimal filtering
+ * algorithm F(2x2, 3x3): each 4x4 input tile and 3x3 filter are transformed
+ * to 4x4 matrices whose elementwise products, summed over the channels by 16
+ * GEMMs, transform back to a 2x2 output tile. This takes 16 instead of 36
+ * multiplications per output tile and channel pair.
+ *
+ * The transformed filters are kept between passes and only recomputed after
+ * the weights were written to, as told by the version of their memory, i.e.
+ * once per weight update. The backward pass uses the GEMM implementation.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  // Whether the layer is computed with Winograd rather than the fallback.
+  bool use_winograd_;
+  int tiles_h_, tiles_w_;
+  // The filters transformed to 16 x num_output x channels, and the memory
+  // and version of the weights they were computed from.
+  Blob<Dtype> transformed_weight_;
+  const SyncedMemory* transformed_memory_;
+  size_t transformed_version_;
+
+ private:
+  void transform_filters();
+  void winograd_forward_cpu(const Dtype* input, const Dtype* weights,
+      Dtype* output);
 };
 
 /**
@@ -409,6 +499,12 @@ class PoolingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// @brief MAX and AVE pooling of channel-last (NHWC) blobs, CPU only.
+  void ChannelLastForward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void ChannelLastBackward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
   int pad_h_, pad_w_;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <climits>
 #include <vector>
 
@@ -133,6 +134,26 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ShareDataMemory(const shared_ptr<SyncedMemory>& data) {
+  CHECK(data);
+  const int data_capacity = data->size() / sizeof(Dtype);
+  CHECK_GE(data_capacity, count_);
+  data_ = data;
+  // diff_ still has the old capacity, so never grow past it.
+  capacity_ = std::min(capacity_, data_capacity);
+}
+
+template <typename Dtype>
+void Blob<Dtype>::Swap(Blob* other) {
+  CHECK(other);
+  data_.swap(other->data_);
+  diff_.swap(other->diff_);
+  shape_.swap(other->shape_);
+  std::swap(count_, other->count_);
+  std::swap(capacity_, other->capacity_);
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
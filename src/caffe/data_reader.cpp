@@ -1,4 +1,9 @@
 #include <boost/thread.hpp>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <stdint.h>
+
+#include <algorithm>
 #include <map>
 #include <string>
 #include <vector>
@@ -41,20 +46,21 @@ DataReader::~DataReader() {
 
 //
 
-DataReader::QueuePair::QueuePair(int size) {
+DataReader::QueuePair::QueuePair(int size)
+    : free_(size), full_(size) {
   // Initialize the free queue with requested number of datums
   for (int i = 0; i < size; ++i) {
-    free_.push(new Datum());
+    free_.push(new Record());
   }
 }
 
 DataReader::QueuePair::~QueuePair() {
-  Datum* datum;
-  while (free_.try_pop(&datum)) {
-    delete datum;
+  Record* record;
+  while (free_.try_pop(&record)) {
+    delete record;
   }
-  while (full_.try_pop(&datum)) {
-    delete datum;
+  while (full_.try_pop(&record)) {
+    delete record;
   }
 }
 
@@ -62,7 +68,8 @@ DataReader::QueuePair::~QueuePair() {
 
 DataReader::Body::Body(const LayerParameter& param)
     : param_(param),
-      new_queue_pairs_() {
+      new_queue_pairs_(),
+      next_shard_(0) {
   StartInternalThread();
 }
 
@@ -73,10 +80,29 @@ DataReader::Body::~Body() {
 void DataReader::Body::InternalThreadEntry() {
   shared_ptr<db::DB> db(db::GetDB(param_.data_param().backend()));
   db->Open(param_.data_param().source(), db::READ);
-  shared_ptr<db::Cursor> cursor(db->NewCursor());
+  shared_ptr<db::Cursor> cursor;
+  const int num_shards = param_.data_param().reader_threads();
+  CHECK_GT(num_shards, 0);
+  if (num_shards == 1) {
+    cursor.reset(db->NewCursor());
+  } else {
+    // Cursors are created here, one after the other, as opening them is not
+    // safe to do concurrently on all backends.
+    for (int i = 0; i < num_shards; ++i) {
+      shards_.push_back(shared_ptr<Shard>(new Shard(db->NewCursor(), i,
+          num_shards, param_.data_param().batch_size())));
+    }
+  }
   vector<shared_ptr<QueuePair> > qps;
   try {
     int solver_count = param_.phase() == TRAIN ? Caffe::solver_count() : 1;
+    // The solvers of other processes take their turns in between
+    const int process_count =
+        param_.phase() == TRAIN ? Caffe::process_count() : 1;
+    const int process_rank =
+        param_.phase() == TRAIN ? Caffe::process_rank() : 0;
+    CHECK_GT(process_count, process_rank);
+    skip(cursor.get(), process_rank * solver_count);
 
     // To ensure deterministic runs, only start running once all solvers
     // are ready. But solvers need to peek on one item during initialization,
@@ -86,11 +112,13 @@ void DataReader::Body::InternalThreadEntry() {
       read_one(cursor.get(), qp.get());
       qps.push_back(qp);
     }
+    skip(cursor.get(), (process_count - 1) * solver_count);
     // Main loop
     while (!must_stop()) {
       for (int i = 0; i < solver_count; ++i) {
         read_one(cursor.get(), qps[i].get());
       }
+      skip(cursor.get(), (process_count - 1) * solver_count);
       // Check no additional readers have been created. This can happen if
       // more than one net is trained at a time per process, whether single
       // or multi solver. It might also happen if two data layers have same
@@ -100,19 +128,142 @@ void DataReader::Body::InternalThreadEntry() {
   } catch (boost::thread_interrupted&) {
     // Interrupted exception is expected on shutdown
   }
+  // Stop the shards before their cursors' database is closed. This thread
+  // may still be asked to stop, so keep joining them from throwing early.
+  boost::this_thread::disable_interruption no_interruption;
+  shards_.clear();
+}
+
+// Parses a serialized Datum except for its data field, which is left empty
+// and pointed to by pixels instead, or NULL if there is none.
+static bool ParseDatumWithoutData(const char* value, size_t size,
+    Datum* datum, const char** pixels, size_t* num_pixels) {
+  using google::protobuf::internal::WireFormatLite;
+  google::protobuf::io::CodedInputStream input(
+      reinterpret_cast<const uint8_t*>(value), size);
+  // The other fields are small, unless the datum holds float_data, in which
+  // case it is parsed from a copy as usual.
+  string fields;
+  *pixels = NULL;
+  while (true) {
+    const int begin = input.CurrentPosition();
+    const uint32_t tag = input.ReadTag();
+    if (tag == 0) {
+      break;
+    }
+    if (WireFormatLite::GetTagFieldNumber(tag) == Datum::kDataFieldNumber &&
+        WireFormatLite::GetTagWireType(tag) ==
+        WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+      uint32_t length;
+      if (!input.ReadVarint32(&length)) {
+        return false;
+      }
+      *pixels = value + input.CurrentPosition();
+      *num_pixels = length;
+      if (!input.Skip(length)) {
+        return false;
+      }
+    } else {
+      if (!WireFormatLite::SkipField(&input, tag)) {
+        return false;
+      }
+      fields.append(value + begin, input.CurrentPosition() - begin);
+    }
+  }
+  return input.CurrentPosition() == static_cast<int>(size) &&
+      datum->ParseFromArray(fields.data(), fields.size());
+}
+
+// Reads the datum at the cursor into record.
+static void ReadRecord(db::Cursor* cursor, DataReader::Record* record) {
+  const char* value;
+  size_t size;
+  // Values that stay valid while the cursor lives are not copied at all: the
+  // data layer transforms the pixels straight from them. Others are parsed
+  // from the cursor's view, without a copy to a string first.
+  if (cursor->value_view(&value, &size)) {
+    size_t num_pixels = 0;
+    CHECK(ParseDatumWithoutData(value, size, &record->datum, &record->pixels,
+        &num_pixels)) << "Failed to parse Datum";
+    // Encoded data is decoded from the Datum itself.
+    if (record->datum.encoded() && record->pixels) {
+      record->datum.set_data(record->pixels, num_pixels);
+      record->pixels = NULL;
+    }
+  } else {
+    CHECK(record->datum.ParseFromArray(value, size))
+        << "Failed to parse Datum";
+    record->pixels = NULL;
+  }
+}
+
+// Moves the cursor count records ahead, going back to the start at the end.
+static void SkipRecords(db::Cursor* cursor, int count) {
+  for (int i = 0; i < count; ++i) {
+    cursor->Next();
+    if (!cursor->valid()) {
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      cursor->SeekToFirst();
+    }
+  }
 }
 
 void DataReader::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
-  Datum* datum = qp->free_.pop();
-  // TODO deserialize in-place instead of copy?
-  datum->ParseFromString(cursor->value());
-  qp->full_.push(datum);
-
-  // go to the next iter
-  cursor->Next();
-  if (!cursor->valid()) {
-    DLOG(INFO) << "Restarting data prefetching from start.";
-    cursor->SeekToFirst();
+  Record* record = qp->free_.pop();
+  if (shards_.empty()) {
+    ReadRecord(cursor, record);
+    // go to the next iter
+    SkipRecords(cursor, 1);
+  } else {
+    // Taking the shards in turn gives the records in database order
+    Shard* shard = shards_[next_shard_].get();
+    Record* parsed = shard->records_.full_.pop();
+    record->datum.Swap(&parsed->datum);
+    std::swap(record->pixels, parsed->pixels);
+    shard->records_.free_.push(parsed);
+    next_shard_ = (next_shard_ + 1) % shards_.size();
+  }
+  qp->full_.push(record);
+}
+
+void DataReader::Body::skip(db::Cursor* cursor, int count) {
+  if (shards_.empty()) {
+    SkipRecords(cursor, count);
+    return;
+  }
+  for (int i = 0; i < count; ++i) {
+    Shard* shard = shards_[next_shard_].get();
+    shard->records_.free_.push(shard->records_.full_.pop());
+    next_shard_ = (next_shard_ + 1) % shards_.size();
+  }
+}
+
+//
+
+DataReader::Shard::Shard(db::Cursor* cursor, int index, int num_shards,
+    int size)
+    : records_(size),
+      cursor_(cursor),
+      index_(index),
+      num_shards_(num_shards) {
+  StartInternalThread();
+}
+
+DataReader::Shard::~Shard() {
+  StopInternalThread();
+}
+
+void DataReader::Shard::InternalThreadEntry() {
+  try {
+    SkipRecords(cursor_.get(), index_);
+    while (!must_stop()) {
+      Record* record = records_.free_.pop();
+      ReadRecord(cursor_.get(), record);
+      records_.full_.push(record);
+      SkipRecords(cursor_.get(), num_shards_);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
   }
 }
 
@@ -10,6 +10,75 @@
 
 namespace caffe {
 
+// Transforms one row of width pixels, read every src_step elements, into
+// (pixel - mean) * scale, written right to left if kMirror. The mean is a
+// row of the mean blob if kMeanBlob, else mean_value. The choices are made
+// at compile time so the loop has no branches and vectorizes.
+template <bool kMirror, bool kMeanBlob, typename Src, typename Dtype>
+static inline void TransformRow(const Src* src, const int src_step,
+    const Dtype* mean, const Dtype mean_value, const Dtype scale,
+    const int width, Dtype* dst) {
+  const int dst_step = kMirror ? -1 : 1;
+  if (kMirror) {
+    dst += width - 1;
+  }
+  for (int w = 0; w < width; ++w) {
+    const Dtype pixel = static_cast<Dtype>(src[w * src_step]);
+    dst[w * dst_step] = (pixel - (kMeanBlob ? mean[w] : mean_value)) * scale;
+  }
+}
+
+// Transforms a channels x height x width image into dst, one row at a time.
+// Channel c, row h of the source starts at src + c * src_channel_step
+// + h * src_row_step, and likewise for the mean blob, if any.
+template <bool kMirror, bool kMeanBlob, typename Src, typename Dtype>
+static void TransformRows(const Src* src, const int src_channel_step,
+    const int src_row_step, const int src_step, const Dtype* mean,
+    const int mean_channel_step, const int mean_row_step,
+    const vector<Dtype>& mean_values, const Dtype scale, const int channels,
+    const int height, const int width, Dtype* dst) {
+  for (int c = 0; c < channels; ++c) {
+    const Dtype mean_value = mean_values.size() ? mean_values[c] : Dtype(0);
+    for (int h = 0; h < height; ++h) {
+      const Dtype* mean_row = kMeanBlob ?
+          mean + c * mean_channel_step + h * mean_row_step : NULL;
+      TransformRow<kMirror, kMeanBlob>(
+          src + c * src_channel_step + h * src_row_step, src_step, mean_row,
+          mean_value, scale, width, dst + (c * height + h) * width);
+    }
+  }
+}
+
+// Picks the loop for mirroring and the kind of mean once per image.
+template <typename Src, typename Dtype>
+static void TransformImage(const bool do_mirror, const Src* src,
+    const int src_channel_step, const int src_row_step, const int src_step,
+    const Dtype* mean, const int mean_channel_step, const int mean_row_step,
+    const vector<Dtype>& mean_values, const Dtype scale, const int channels,
+    const int height, const int width, Dtype* dst) {
+  if (do_mirror) {
+    if (mean) {
+      TransformRows<true, true>(src, src_channel_step, src_row_step, src_step,
+          mean, mean_channel_step, mean_row_step, mean_values, scale,
+          channels, height, width, dst);
+    } else {
+      TransformRows<true, false>(src, src_channel_step, src_row_step,
+          src_step, mean, mean_channel_step, mean_row_step, mean_values,
+          scale, channels, height, width, dst);
+    }
+  } else {
+    if (mean) {
+      TransformRows<false, true>(src, src_channel_step, src_row_step,
+          src_step, mean, mean_channel_step, mean_row_step, mean_values,
+          scale, channels, height, width, dst);
+    } else {
+      TransformRows<false, false>(src, src_channel_step, src_row_step,
+          src_step, mean, mean_channel_step, mean_row_step, mean_values,
+          scale, channels, height, width, dst);
+    }
+  }
+}
+
 template<typename Dtype>
 DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
     Phase phase)
@@ -38,8 +107,8 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
 
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
+                                       const char* pixels,
                                        Dtype* transformed_data) {
-  const string& data = datum.data();
   const int datum_channels = datum.channels();
   const int datum_height = datum.height();
   const int datum_width = datum.width();
@@ -48,19 +117,19 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   const Dtype scale = param_.scale();
   const bool do_mirror = param_.mirror() && Rand(2);
   const bool has_mean_file = param_.has_mean_file();
-  const bool has_uint8 = data.size() > 0;
+  const bool has_uint8 = pixels != NULL;
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(datum_channels, 0);
   CHECK_GE(datum_height, crop_size);
   CHECK_GE(datum_width, crop_size);
 
-  Dtype* mean = NULL;
+  const Dtype* mean = NULL;
   if (has_mean_file) {
     CHECK_EQ(datum_channels, data_mean_.channels());
     CHECK_EQ(datum_height, data_mean_.height());
     CHECK_EQ(datum_width, data_mean_.width());
-    mean = data_mean_.mutable_cpu_data();
+    mean = data_mean_.cpu_data();
   }
   if (has_mean_values) {
     CHECK(mean_values_.size() == 1 || mean_values_.size() == datum_channels) <<
@@ -91,44 +160,37 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     }
   }
 
-  Dtype datum_element;
-  int top_index, data_index;
-  for (int c = 0; c < datum_channels; ++c) {
-    for (int h = 0; h < height; ++h) {
-      for (int w = 0; w < width; ++w) {
-        data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
-        if (do_mirror) {
-          top_index = (c * height + h) * width + (width - 1 - w);
-        } else {
-          top_index = (c * height + h) * width + w;
-        }
-        if (has_uint8) {
-          datum_element =
-            static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-        } else {
-          datum_element = datum.float_data(data_index);
-        }
-        if (has_mean_file) {
-          transformed_data[top_index] =
-            (datum_element - mean[data_index]) * scale;
-        } else {
-          if (has_mean_values) {
-            transformed_data[top_index] =
-              (datum_element - mean_values_[c]) * scale;
-          } else {
-            transformed_data[top_index] = datum_element * scale;
-          }
-        }
-      }
-    }
+  // The mean blob has the shape of the datum, so they are cropped alike.
+  const int offset = h_off * datum_width + w_off;
+  const int channel_step = datum_height * datum_width;
+  if (mean) {
+    mean += offset;
   }
+  if (has_uint8) {
+    TransformImage(do_mirror,
+        reinterpret_cast<const uint8_t*>(pixels) + offset, channel_step,
+        datum_width, 1, mean, channel_step, datum_width, mean_values_, scale,
+        datum_channels, height, width, transformed_data);
+  } else {
+    TransformImage(do_mirror, datum.float_data().data() + offset,
+        channel_step, datum_width, 1, mean, channel_step, datum_width,
+        mean_values_, scale, datum_channels, height, width, transformed_data);
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const Datum& datum,
+                                       Blob<Dtype>* transformed_blob) {
+  Transform(datum, NULL, transformed_blob);
 }
 
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
+                                       const char* pixels,
                                        Blob<Dtype>* transformed_blob) {
   // If datum is encoded, decoded and transform the cv::image.
   if (datum.encoded()) {
+    CHECK(pixels == NULL) << "Encoded datums must hold their own data";
     CHECK(!(param_.force_color() && param_.force_gray()))
         << "cannot set both force_color and force_gray";
     cv::Mat cv_img;
@@ -170,8 +232,11 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     CHECK_EQ(datum_width, width);
   }
 
+  if (pixels == NULL && datum.data().size() > 0) {
+    pixels = datum.data().data();
+  }
   Dtype* transformed_data = transformed_blob->mutable_cpu_data();
-  Transform(datum, transformed_data);
+  Transform(datum, pixels, transformed_data);
 }
 
 template<typename Dtype>
@@ -244,12 +309,12 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   CHECK_GE(img_height, crop_size);
   CHECK_GE(img_width, crop_size);
 
-  Dtype* mean = NULL;
+  const Dtype* mean = NULL;
   if (has_mean_file) {
     CHECK_EQ(img_channels, data_mean_.channels());
     CHECK_EQ(img_height, data_mean_.height());
     CHECK_EQ(img_width, data_mean_.width());
-    mean = data_mean_.mutable_cpu_data();
+    mean = data_mean_.cpu_data();
   }
   if (has_mean_values) {
     CHECK(mean_values_.size() == 1 || mean_values_.size() == img_channels) <<
@@ -285,35 +350,15 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
 
   CHECK(cv_cropped_img.data);
 
-  Dtype* transformed_data = transformed_blob->mutable_cpu_data();
-  int top_index;
-  for (int h = 0; h < height; ++h) {
-    const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
-    int img_index = 0;
-    for (int w = 0; w < width; ++w) {
-      for (int c = 0; c < img_channels; ++c) {
-        if (do_mirror) {
-          top_index = (c * height + h) * width + (width - 1 - w);
-        } else {
-          top_index = (c * height + h) * width + w;
-        }
-        // int top_index = (c * height + h) * width + w;
-        Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-        if (has_mean_file) {
-          int mean_index = (c * img_height + h_off + h) * img_width + w_off + w;
-          transformed_data[top_index] =
-            (pixel - mean[mean_index]) * scale;
-        } else {
-          if (has_mean_values) {
-            transformed_data[top_index] =
-              (pixel - mean_values_[c]) * scale;
-          } else {
-            transformed_data[top_index] = pixel * scale;
-          }
-        }
-      }
-    }
+  // Pixels are interleaved, so each channel's row is read with a step.
+  if (mean) {
+    mean += h_off * img_width + w_off;
   }
+  Dtype* transformed_data = transformed_blob->mutable_cpu_data();
+  TransformImage(do_mirror, cv_cropped_img.ptr<uchar>(0), 1,
+      static_cast<int>(cv_cropped_img.step), img_channels, mean,
+      img_height * img_width, img_width, mean_values_, scale, img_channels,
+      height, width, transformed_data);
 }
 
 template<typename Dtype>
@@ -517,6 +562,17 @@ void DataTransformer<Dtype>::InitRand() {
   }
 }
 
+template <typename Dtype>
+void DataTransformer<Dtype>::InitRand(unsigned int seed) {
+  const bool needs_rand = param_.mirror() ||
+      (phase_ == TRAIN && param_.crop_size());
+  if (needs_rand) {
+    rng_.reset(new Caffe::RNG(seed));
+  } else {
+    rng_.reset();
+  }
+}
+
 template <typename Dtype>
 int DataTransformer<Dtype>::Rand(int n) {
   CHECK(rng_);
@@ -1,9 +1,15 @@
+#include <algorithm>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/workspace.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -53,6 +59,7 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // and no padding, so flag for skipping the buffer and transformation.
   is_1x1_ = kernel_w_ == 1 && kernel_h_ == 1
       && stride_h_ == 1 && stride_w_ == 1 && pad_h_ == 0 && pad_w_ == 0;
+  parallel_batch_ = conv_param.parallel_batch();
   // Configure output channels and groups.
   channels_ = bottom[0]->channels();
   num_output_ = this->layer_param_.convolution_param().num_output();
@@ -98,6 +105,15 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  if (this->layer_param_.layout() == NHWC) {
+    CHECK(!reverse_dimensions()) << "NHWC layout is not implemented for "
+        << this->type() << " layers.";
+    CHECK_EQ(group_, 1) << "NHWC layout is only implemented for group 1.";
+    CHECK_EQ(Caffe::mode(), Caffe::CPU)
+        << "NHWC layout is only implemented on the CPU.";
+    channel_last_weight_.Reshape(num_output_, kernel_h_, kernel_w_,
+        channels_);
+  }
 }
 
 template <typename Dtype>
@@ -139,12 +155,12 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   col_offset_ = kernel_dim_ * conv_out_spatial_dim_ / group_;
   output_offset_ = conv_out_channels_ * conv_out_spatial_dim_ / group_;
   // The im2col result buffer will only hold one image at a time to avoid
-  // overly large memory usage. In the special case of 1x1 convolution
-  // it goes lazily unused to save memory.
-  if (reverse_dimensions()) {
-    col_buffer_.Reshape(1, kernel_dim_, height_, width_);
-  } else {
-    col_buffer_.Reshape(1, kernel_dim_, height_out_, width_out_);
+  // overly large memory usage. It lives in the Workspace shared by all the
+  // layers of this thread, sized for the largest of them. In the special case
+  // of 1x1 convolution it goes unused to save memory.
+  col_buffer_count_ = kernel_dim_ * conv_out_spatial_dim_;
+  if (!is_1x1_) {
+    col_buffer();
   }
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   if (bias_term_) {
@@ -155,15 +171,20 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+Blob<Dtype>* BaseConvolutionLayer<Dtype>::col_buffer() {
+  return Workspace<Dtype>::Get(col_buffer_count_);
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
     const Dtype* weights, Dtype* output, bool skip_im2col) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_buffer()->mutable_cpu_data());
     }
-    col_buff = col_buffer_.cpu_data();
+    col_buff = col_buffer()->cpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
@@ -184,9 +205,9 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
-  if (is_1x1_) {
-    col_buff = input;
+  Dtype* col_buff = input;
+  if (!is_1x1_) {
+    col_buff = col_buffer()->mutable_cpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
@@ -204,8 +225,8 @@ void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    conv_im2col_cpu(input, col_buffer()->mutable_cpu_data());
+    col_buff = col_buffer()->cpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
@@ -215,6 +236,44 @@ void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
   }
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_batch(const Dtype* input,
+    const Dtype* output, Dtype* weights) {
+  const int input_dim = conv_in_channels_ * conv_in_height_ * conv_in_width_;
+  const int output_dim = conv_out_channels_ * conv_out_spatial_dim_;
+  int num_threads = 1;
+#ifdef _OPENMP
+  if (parallel_batch_) {
+    num_threads = std::min(omp_get_max_threads(), num_);
+  }
+#endif
+  if (num_threads == 1) {
+    for (int n = 0; n < num_; ++n) {
+      weight_cpu_gemm(input + n * input_dim, output + n * output_dim, weights);
+    }
+    return;
+  }
+  // Thread t takes images t, t + num_threads, ... so that the sum does not
+  // depend on the scheduling.
+  const int weight_count = this->blobs_[0]->count();
+  weight_diff_buffer_.Reshape(vector<int>(1, num_threads * weight_count));
+  Dtype* partial_weights = weight_diff_buffer_.mutable_cpu_data();
+  caffe_set(weight_diff_buffer_.count(), Dtype(0), partial_weights);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+  for (int t = 0; t < num_threads; ++t) {
+    for (int n = t; n < num_; n += num_threads) {
+      weight_cpu_gemm(input + n * input_dim, output + n * output_dim,
+          partial_weights + t * weight_count);
+    }
+  }
+  for (int t = 0; t < num_threads; ++t) {
+    caffe_axpy(weight_count, Dtype(1), partial_weights + t * weight_count,
+        weights);
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
     const Dtype* input) {
@@ -222,6 +281,62 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_channel_last(
+    const Dtype* input, const Dtype* weights, Dtype* output) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_channel_last_cpu(input, col_buffer()->mutable_cpu_data());
+    col_buff = col_buffer()->cpu_data();
+  }
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_spatial_dim_,
+      conv_out_channels_, kernel_dim_,
+      (Dtype)1., col_buff, weights, (Dtype)0., output);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_bias_channel_last(
+    Dtype* output, const Dtype* bias) {
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, height_out_ * width_out_,
+      num_output_, 1, (Dtype)1., bias_multiplier_.cpu_data(), bias,
+      (Dtype)1., output);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_gemm_channel_last(
+    const Dtype* output, const Dtype* weights, Dtype* input) {
+  Dtype* col_buff = input;
+  if (!is_1x1_) {
+    col_buff = col_buffer()->mutable_cpu_data();
+  }
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_spatial_dim_,
+      kernel_dim_, conv_out_channels_,
+      (Dtype)1., output, weights, (Dtype)0., col_buff);
+  if (!is_1x1_) {
+    conv_col2im_channel_last_cpu(col_buff, input);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_channel_last(
+    const Dtype* input, const Dtype* output, Dtype* weights) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_channel_last_cpu(input, col_buffer()->mutable_cpu_data());
+    col_buff = col_buffer()->cpu_data();
+  }
+  caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, conv_out_channels_,
+      kernel_dim_, conv_out_spatial_dim_,
+      (Dtype)1., output, col_buff, (Dtype)1., weights);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_bias_channel_last(Dtype* bias,
+    const Dtype* input) {
+  caffe_cpu_gemv<Dtype>(CblasTrans, height_out_ * width_out_, num_output_, 1.,
+      input, bias_multiplier_.cpu_data(), 1., bias);
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -230,9 +345,9 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_gemm(const Dtype* input,
   const Dtype* col_buff = input;
   if (!is_1x1_) {
     if (!skip_im2col) {
-      conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
+      conv_im2col_gpu(input, col_buffer()->mutable_gpu_data());
     }
-    col_buff = col_buffer_.gpu_data();
+    col_buff = col_buffer()->gpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
@@ -253,9 +368,9 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_bias(Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_gpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_gpu_data();
-  if (is_1x1_) {
-    col_buff = input;
+  Dtype* col_buff = input;
+  if (!is_1x1_) {
+    col_buff = col_buffer()->mutable_gpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
@@ -273,8 +388,8 @@ void BaseConvolutionLayer<Dtype>::weight_gpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
-    col_buff = col_buffer_.gpu_data();
+    conv_im2col_gpu(input, col_buffer()->mutable_gpu_data());
+    col_buff = col_buffer()->gpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
@@ -1,10 +1,14 @@
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/net.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -33,9 +37,13 @@ template <typename Dtype>
 BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
     const LayerParameter& param)
     : BaseDataLayer<Dtype>(param),
-      prefetch_free_(), prefetch_full_() {
-  for (int i = 0; i < PREFETCH_COUNT; ++i) {
-    prefetch_free_.push(&prefetch_[i]);
+      prefetch_(param.has_data_param() ?
+          std::max<int>(param.data_param().prefetch(), 1) : 3),
+      prefetch_free_(prefetch_.size()), prefetch_full_(prefetch_.size()),
+      swap_prefetched_(false), item_threads_(1) {
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i].reset(new Batch<Dtype>());
+    prefetch_free_.push(prefetch_[i].get());
   }
 }
 
@@ -43,22 +51,26 @@ template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
+  // Swapping with the top blobs would make the prefetch thread fetch their
+  // data back from the GPU before overwriting it, so only swap on the CPU.
+  swap_prefetched_ = this->layer_param_.data_param().swap_prefetched() &&
+      Caffe::mode() == Caffe::CPU;
   // Before starting the prefetch thread, we make cpu_data and gpu_data
   // calls so that the prefetch thread does not accidentally make simultaneous
   // cudaMalloc calls when the main thread is running. In some GPUs this
   // seems to cause failures if we do not so.
-  for (int i = 0; i < PREFETCH_COUNT; ++i) {
-    prefetch_[i].data_.mutable_cpu_data();
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i]->data_.mutable_cpu_data();
     if (this->output_labels_) {
-      prefetch_[i].label_.mutable_cpu_data();
+      prefetch_[i]->label_.mutable_cpu_data();
     }
   }
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
-    for (int i = 0; i < PREFETCH_COUNT; ++i) {
-      prefetch_[i].data_.mutable_gpu_data();
+    for (int i = 0; i < prefetch_.size(); ++i) {
+      prefetch_[i]->data_.mutable_gpu_data();
       if (this->output_labels_) {
-        prefetch_[i].label_.mutable_gpu_data();
+        prefetch_[i]->label_.mutable_gpu_data();
       }
     }
   }
@@ -100,27 +112,85 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
 #endif
 }
 
+template <typename Dtype>
+Batch<Dtype>* BasePrefetchingDataLayer<Dtype>::next_batch() {
+  const size_t waits = prefetch_full_.pop_waits();
+  Batch<Dtype>* batch = prefetch_full_.pop();
+  if (prefetch_full_.pop_waits() > waits) {
+    LOG_EVERY_N(INFO, 100) << this->layer_param_.name() << " waited for data "
+        << prefetch_full_.pop_waits() << " times, "
+        << prefetch_full_.pop_wait_time() << " ms in total";
+  }
+  return batch;
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  Batch<Dtype>* batch = prefetch_full_.pop("Data layer prefetch queue empty");
-  // Reshape to loaded data.
-  top[0]->ReshapeLike(batch->data_);
-  // Copy the data
-  caffe_copy(batch->data_.count(), batch->data_.cpu_data(),
-             top[0]->mutable_cpu_data());
+  Batch<Dtype>* batch = next_batch();
+  OutputPrefetched(&batch->data_, top[0]);
   DLOG(INFO) << "Prefetch copied";
   if (this->output_labels_) {
-    // Reshape to loaded labels.
-    top[1]->ReshapeLike(batch->label_);
-    // Copy the labels.
-    caffe_copy(batch->label_.count(), batch->label_.cpu_data(),
-        top[1]->mutable_cpu_data());
+    OutputPrefetched(&batch->label_, top[1]);
   }
-
+  // If swapped, the batch now holds the previous top memory, which is
+  // refilled in turn.
   prefetch_free_.push(batch);
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::OutputPrefetched(
+    Blob<Dtype>* prefetched, Blob<Dtype>* top) {
+  if (swap_prefetched_) {
+    top->Swap(prefetched);
+    return;
+  }
+  // Reshape to and copy the loaded blob.
+  top->ReshapeLike(*prefetched);
+  caffe_copy(prefetched->count(), prefetched->cpu_data(),
+      top->mutable_cpu_data());
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::SetUpItemThreads(int num_threads) {
+  CHECK_GT(num_threads, 0);
+  item_seed_rng_.reset(new Caffe::RNG(caffe_rng_rand()));
+  item_threads_ = num_threads;
+  if (num_threads > 1) {
+    for (int i = 0; i < num_threads; ++i) {
+      item_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+    }
+  }
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::LoadItems(int batch_size,
+    Batch<Dtype>* batch) {
+  item_seeds_.resize(batch_size);
+  caffe::rng_t* seed_rng =
+      static_cast<caffe::rng_t*>(item_seed_rng_->generator());
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    item_seeds_[item_id] = (*seed_rng)();
+  }
+  if (item_threads_ == 1) {
+    load_items(0, batch_size, 0, this->data_transformer_.get(), batch);
+    return;
+  }
+  if (!item_pool_) {
+    item_pool_.reset(new ThreadPool(item_threads_));
+  }
+  const int num_threads = item_threads_;
+  vector<ThreadPool::Task> tasks(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    tasks[i] = boost::bind(&BasePrefetchingDataLayer<Dtype>::load_items, this,
+        batch_size * i / num_threads, batch_size * (i + 1) / num_threads, i,
+        item_transformers_[i].get(), batch);
+  }
+  item_pool_->Run(tasks);
+}
+
 #ifdef CPU_ONLY
 STUB_GPU_FORWARD(BasePrefetchingDataLayer, Forward);
 #endif
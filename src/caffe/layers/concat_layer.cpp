@@ -32,8 +32,15 @@ void ConcatLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
   // Initialize with the first blob.
   vector<int> top_shape = bottom[0]->shape();
-  num_concats_ = bottom[0]->count(0, concat_axis_);
-  concat_input_size_ = bottom[0]->count(concat_axis_ + 1);
+  if (this->layer_param_.layout() == NHWC) {
+    // The channels are innermost: every pixel of every image is a concat.
+    CHECK_EQ(concat_axis_, 1) << "NHWC concatenation is along channels only.";
+    num_concats_ = bottom[0]->count(0, concat_axis_) * bottom[0]->count(2);
+    concat_input_size_ = 1;
+  } else {
+    num_concats_ = bottom[0]->count(0, concat_axis_);
+    concat_input_size_ = bottom[0]->count(concat_axis_ + 1);
+  }
   int bottom_count_sum = bottom[0]->count();
   for (int i = 1; i < bottom.size(); ++i) {
     CHECK_EQ(num_axes, bottom[i]->num_axes())
@@ -16,13 +16,50 @@ void ConvolutionLayer<Dtype>::compute_output_shape() {
       / this->stride_w_ + 1;
 }
 
+// Reorder num x channels x spatial_dim filters to num x spatial_dim x
+// channels, as the channel-last helpers expect.
+template <typename Dtype>
+static void filters_to_channel_last(const int num, const int channels,
+    const int spatial_dim, const Dtype* src, Dtype* dst) {
+  for (int n = 0; n < num; ++n) {
+    for (int c = 0; c < channels; ++c) {
+      for (int k = 0; k < spatial_dim; ++k) {
+        dst[(n * spatial_dim + k) * channels + c] =
+            src[(n * channels + c) * spatial_dim + k];
+      }
+    }
+  }
+}
+
+// The inverse of filters_to_channel_last, accumulating into dst.
+template <typename Dtype>
+static void add_filters_from_channel_last(const int num, const int channels,
+    const int spatial_dim, const Dtype* src, Dtype* dst) {
+  for (int n = 0; n < num; ++n) {
+    for (int c = 0; c < channels; ++c) {
+      for (int k = 0; k < spatial_dim; ++k) {
+        dst[(n * channels + c) * spatial_dim + k] +=
+            src[(n * spatial_dim + k) * channels + c];
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (this->layer_param_.layout() == NHWC) {
+    ChannelLastForward_cpu(bottom, top);
+    return;
+  }
   const Dtype* weight = this->blobs_[0]->cpu_data();
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
+    // With parallel_batch each thread im2cols into its own Workspace buffer.
+#ifdef _OPENMP
+#pragma omp parallel for if (this->parallel_batch_)
+#endif
     for (int n = 0; n < this->num_; ++n) {
       this->forward_cpu_gemm(bottom_data + bottom[i]->offset(n), weight,
           top_data + top[i]->offset(n));
@@ -37,6 +74,10 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (this->layer_param_.layout() == NHWC) {
+    ChannelLastBackward_cpu(top, propagate_down, bottom);
+    return;
+  }
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   for (int i = 0; i < top.size(); ++i) {
@@ -50,21 +91,86 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         this->backward_cpu_bias(bias_diff, top_diff + top[i]->offset(n));
       }
     }
+    // gradient w.r.t. weight. Note that we will accumulate diffs.
+    if (this->param_propagate_down_[0]) {
+      this->weight_cpu_gemm_batch(bottom_data, top_diff, weight_diff);
+    }
+    // gradient w.r.t. bottom data, if necessary.
+    if (propagate_down[i]) {
+#ifdef _OPENMP
+#pragma omp parallel for if (this->parallel_batch_)
+#endif
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_cpu_gemm(top_diff + top[i]->offset(n), weight,
+            bottom_diff + bottom[i]->offset(n));
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::ChannelLastForward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int kernel_spatial_dim = this->kernel_h_ * this->kernel_w_;
+  filters_to_channel_last(this->num_output_, this->channels_,
+      kernel_spatial_dim, this->blobs_[0]->cpu_data(),
+      this->channel_last_weight_.mutable_cpu_data());
+  const Dtype* weight = this->channel_last_weight_.cpu_data();
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      this->forward_cpu_gemm_channel_last(bottom_data + bottom[i]->offset(n),
+          weight, top_data + top[i]->offset(n));
+      if (this->bias_term_) {
+        const Dtype* bias = this->blobs_[1]->cpu_data();
+        this->forward_cpu_bias_channel_last(top_data + top[i]->offset(n),
+            bias);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::ChannelLastBackward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  // channel_last_weight_ still holds the reordered filters from forward.
+  const Dtype* weight = this->channel_last_weight_.cpu_data();
+  Dtype* weight_diff = this->channel_last_weight_.mutable_cpu_diff();
+  caffe_set(this->channel_last_weight_.count(), Dtype(0), weight_diff);
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias_channel_last(bias_diff,
+            top_diff + top[i]->offset(n));
+      }
+    }
     if (this->param_propagate_down_[0] || propagate_down[i]) {
       for (int n = 0; n < this->num_; ++n) {
-        // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
-          this->weight_cpu_gemm(bottom_data + bottom[i]->offset(n),
+          this->weight_cpu_gemm_channel_last(
+              bottom_data + bottom[i]->offset(n),
               top_diff + top[i]->offset(n), weight_diff);
         }
-        // gradient w.r.t. bottom data, if necessary.
         if (propagate_down[i]) {
-          this->backward_cpu_gemm(top_diff + top[i]->offset(n), weight,
-              bottom_diff + bottom[i]->offset(n));
+          this->backward_cpu_gemm_channel_last(top_diff + top[i]->offset(n),
+              weight, bottom_diff + bottom[i]->offset(n));
         }
       }
     }
   }
+  // Accumulate into the filter gradient in its usual order.
+  if (this->param_propagate_down_[0]) {
+    add_filters_from_channel_last(this->num_output_, this->channels_,
+        this->kernel_h_ * this->kernel_w_, weight_diff,
+        this->blobs_[0]->mutable_cpu_diff());
+  }
 }
 
 #ifdef CPU_ONLY
@@ -1,5 +1,8 @@
+#include <boost/bind.hpp>
 #include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
@@ -12,6 +15,7 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -70,8 +74,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int batch_size = this->layer_param_.image_data_param().batch_size();
   CHECK_GT(batch_size, 0) << "Positive batch size required";
   top_shape[0] = batch_size;
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].data_.Reshape(top_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape);
   }
   top[0]->Reshape(top_shape);
 
@@ -81,9 +85,16 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // label
   vector<int> label_shape(1, batch_size);
   top[1]->Reshape(label_shape);
-  for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
-    this->prefetch_[i].label_.Reshape(label_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.Reshape(label_shape);
   }
+  const int num_threads =
+      this->layer_param_.image_data_param().decode_threads();
+  this->SetUpItemThreads(num_threads);
+  read_time_.resize(num_threads);
+  decode_time_.resize(num_threads);
+  trans_time_.resize(num_threads);
+  readahead_id_ = lines_id_;
 }
 
 template <typename Dtype>
@@ -93,12 +104,28 @@ void ImageDataLayer<Dtype>::ShuffleImages() {
   shuffle(lines_.begin(), lines_.end(), prefetch_rng);
 }
 
+template <typename Dtype>
+void ImageDataLayer<Dtype>::ReadAhead() {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  // Stop at the end of the epoch, as the lines may be shuffled then.
+  const int end = std::min<int>(lines_.size(), lines_id_ +
+      image_data_param.readahead_batches() * image_data_param.batch_size());
+  readahead_id_ = std::max(readahead_id_, lines_id_);
+  for (; readahead_id_ < end; ++readahead_id_) {
+    const string filename =
+        image_data_param.root_folder() + lines_[readahead_id_].first;
+    readahead_pool_->Enqueue(boost::bind(&ReadAheadFile, filename));
+  }
+}
+
 // This function is called on prefetch thread
 template <typename Dtype>
 void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer batch_timer;
   batch_timer.Start();
   double read_time = 0;
+  double decode_time = 0;
   double trans_time = 0;
   CPUTimer timer;
   CHECK(batch->data_.count());
@@ -122,44 +149,95 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   top_shape[0] = batch_size;
   batch->data_.Reshape(top_shape);
 
-  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
-  Dtype* prefetch_label = batch->label_.mutable_cpu_data();
+  // Allocate the batch here rather than in the decode threads.
+  batch->data_.mutable_cpu_data();
+  batch->label_.mutable_cpu_data();
 
-  // datum scales
+  // Take the lines of the batch in order, then read ahead of them.
   const int lines_size = lines_.size();
+  batch_lines_.resize(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    timer.Start();
     CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
-
-    prefetch_label[item_id] = lines_[lines_id_].second;
+    batch_lines_[item_id] = lines_[lines_id_];
     // go to the next iter
     lines_id_++;
     if (lines_id_ >= lines_size) {
       // We have reached the end. Restart from the first.
       DLOG(INFO) << "Restarting data prefetching from start.";
       lines_id_ = 0;
+      readahead_id_ = 0;
       if (this->layer_param_.image_data_param().shuffle()) {
         ShuffleImages();
       }
     }
   }
+  if (image_data_param.readahead_batches() > 0) {
+    if (!readahead_pool_) {
+      readahead_pool_.reset(new ThreadPool(1));
+    }
+    ReadAhead();
+  }
+
+  std::fill(read_time_.begin(), read_time_.end(), 0);
+  std::fill(decode_time_.begin(), decode_time_.end(), 0);
+  std::fill(trans_time_.begin(), trans_time_.end(), 0);
+  this->LoadItems(batch_size, batch);
+  for (int i = 0; i < read_time_.size(); ++i) {
+    read_time += read_time_[i];
+    decode_time += decode_time_[i];
+    trans_time += trans_time_[i];
+  }
   batch_timer.Stop();
+  // The stage times add up over the decode threads.
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
+  DLOG(INFO) << "   Decode time: " << decode_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+// This function is called on prefetch thread, or on a worker thread
+template <typename Dtype>
+void ImageDataLayer<Dtype>::load_items(int begin, int end, int thread_id,
+    DataTransformer<Dtype>* transformer, Batch<Dtype>* batch) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const int new_height = image_data_param.new_height();
+  const int new_width = image_data_param.new_width();
+  const bool is_color = image_data_param.is_color();
+  const string& root_folder = image_data_param.root_folder();
+  Blob<Dtype> transformed_data(this->transformed_data_.shape());
+  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
+  Dtype* prefetch_label = batch->label_.mutable_cpu_data();
+  CPUTimer timer;
+  Datum datum;
+  for (int item_id = begin; item_id < end; ++item_id) {
+    const string& filename = batch_lines_[item_id].first;
+    // Read the file, then decode and resize it, as ReadImageToCVMat does.
+    timer.Start();
+    CHECK(ReadFileToDatum(root_folder + filename, &datum))
+        << "Could not load " << filename;
+    read_time_[thread_id] += timer.MicroSeconds();
+    timer.Start();
+    cv::Mat cv_img = DecodeDatumToCVMat(datum, is_color);
+    CHECK(cv_img.data) << "Could not decode " << filename;
+    if (new_height > 0 && new_width > 0) {
+      cv::Mat cv_img_resized;
+      cv::resize(cv_img, cv_img_resized, cv::Size(new_width, new_height));
+      cv_img = cv_img_resized;
+    }
+    decode_time_[thread_id] += timer.MicroSeconds();
+    timer.Start();
+    // Apply transformations (mirror, crop...) to the image
+    this->InitItemRand(item_id, transformer);
+    int offset = batch->data_.offset(item_id);
+    transformed_data.set_cpu_data(prefetch_data + offset);
+    transformer->Transform(cv_img, &transformed_data);
+    trans_time_[thread_id] += timer.MicroSeconds();
+
+    prefetch_label[item_id] = batch_lines_[item_id].second;
+  }
+}
+
 INSTANTIATE_CLASS(ImageDataLayer);
 REGISTER_LAYER_CLASS(ImageData);
 
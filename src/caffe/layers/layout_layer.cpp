@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common_layers.hpp"
+#include "caffe/layer.hpp"
+
+namespace caffe {
+
+// Writes the rows x cols matrix src to dst as a cols x rows matrix, in tiles
+// small enough that both the reads and the writes stay in cache.
+template <typename Dtype>
+static void transpose_cpu(const int rows, const int cols, const Dtype* src,
+    Dtype* dst) {
+  const int kTile = 32;
+  for (int r0 = 0; r0 < rows; r0 += kTile) {
+    const int r1 = std::min(r0 + kTile, rows);
+    for (int c0 = 0; c0 < cols; c0 += kTile) {
+      const int c1 = std::min(c0 + kTile, cols);
+      for (int r = r0; r < r1; ++r) {
+        for (int c = c0; c < c1; ++c) {
+          dst[c * rows + r] = src[r * cols + c];
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_NE(top[0], bottom[0]) << this->type() << " Layer does not "
+      "allow in-place computation.";
+  CHECK_GE(bottom[0]->num_axes(), 2)
+      << "Layout conversion needs a channel axis.";
+  channels_ = bottom[0]->shape(1);
+  spatial_dim_ = bottom[0]->count(2);
+  top[0]->ReshapeLike(*bottom[0]);
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  const int dim = channels_ * spatial_dim_;
+  const bool to_channel_last = this->layer_param_.layout() == NHWC;
+  const int rows = to_channel_last ? channels_ : spatial_dim_;
+  const int cols = to_channel_last ? spatial_dim_ : channels_;
+  const int num = bottom[0]->shape(0);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int n = 0; n < num; ++n) {
+    transpose_cpu(rows, cols, bottom_data + n * dim, top_data + n * dim);
+  }
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const int dim = channels_ * spatial_dim_;
+  const bool to_channel_last = this->layer_param_.layout() == NHWC;
+  const int rows = to_channel_last ? spatial_dim_ : channels_;
+  const int cols = to_channel_last ? channels_ : spatial_dim_;
+  const int num = bottom[0]->shape(0);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int n = 0; n < num; ++n) {
+    transpose_cpu(rows, cols, top_diff + n * dim, bottom_diff + n * dim);
+  }
+}
+
+INSTANTIATE_CLASS(LayoutLayer);
+REGISTER_LAYER_CLASS(Layout);
+
+}  // namespace caffe
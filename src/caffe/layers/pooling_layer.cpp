@@ -76,6 +76,14 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_LT(pad_h_, kernel_h_);
     CHECK_LT(pad_w_, kernel_w_);
   }
+  if (this->layer_param_.layout() == NHWC) {
+    CHECK(pool_param.pool() == PoolingParameter_PoolMethod_AVE
+        || pool_param.pool() == PoolingParameter_PoolMethod_MAX)
+        << "NHWC layout implemented only for average and max pooling.";
+    CHECK_EQ(top.size(), 1) << "NHWC max pooling does not output the mask.";
+    CHECK_EQ(Caffe::mode(), Caffe::CPU)
+        << "NHWC layout is only implemented on the CPU.";
+  }
 }
 
 template <typename Dtype>
@@ -130,6 +138,10 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (this->layer_param_.layout() == NHWC) {
+    ChannelLastForward_cpu(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int top_count = top[0]->count();
@@ -235,6 +247,10 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (!propagate_down[0]) {
     return;
   }
+  if (this->layer_param_.layout() == NHWC) {
+    ChannelLastBackward_cpu(top, propagate_down, bottom);
+    return;
+  }
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
   // Different pooling methods. We explicitly do the switch outside the for
@@ -309,6 +325,134 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+// In channel-last order the values of one pixel are contiguous, so each
+// window is reduced over whole channel vectors at a time. The MAX mask holds
+// the same within-image pixel index h * width_ + w as in the NCHW case, and
+// ties go to the first pixel in the window, as they do there.
+template <typename Dtype>
+void PoolingLayer<Dtype>::ChannelLastForward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  const int num_rows = bottom[0]->num() * pooled_height_;
+  const bool use_max =
+      this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX;
+  int* mask = use_max ? max_idx_.mutable_cpu_data() : NULL;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int row = 0; row < num_rows; ++row) {
+    const int n = row / pooled_height_;
+    const int ph = row % pooled_height_;
+    const Dtype* image_data = bottom_data + n * height_ * width_ * channels_;
+    for (int pw = 0; pw < pooled_width_; ++pw) {
+      const int pool_index = (row * pooled_width_ + pw) * channels_;
+      Dtype* out = top_data + pool_index;
+      int hstart = ph * stride_h_ - pad_h_;
+      int wstart = pw * stride_w_ - pad_w_;
+      if (use_max) {
+        int* out_mask = mask + pool_index;
+        const int hend = min(hstart + kernel_h_, height_);
+        const int wend = min(wstart + kernel_w_, width_);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        for (int c = 0; c < channels_; ++c) {
+          out[c] = -FLT_MAX;
+          out_mask[c] = -1;
+        }
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            const int index = h * width_ + w;
+            const Dtype* in = image_data + index * channels_;
+            for (int c = 0; c < channels_; ++c) {
+              if (in[c] > out[c]) {
+                out[c] = in[c];
+                out_mask[c] = index;
+              }
+            }
+          }
+        }
+      } else {
+        int hend = min(hstart + kernel_h_, height_ + pad_h_);
+        int wend = min(wstart + kernel_w_, width_ + pad_w_);
+        const int pool_size = (hend - hstart) * (wend - wstart);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        hend = min(hend, height_);
+        wend = min(wend, width_);
+        for (int c = 0; c < channels_; ++c) {
+          out[c] = 0;
+        }
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            const Dtype* in = image_data + (h * width_ + w) * channels_;
+            for (int c = 0; c < channels_; ++c) {
+              out[c] += in[c];
+            }
+          }
+        }
+        for (int c = 0; c < channels_; ++c) {
+          out[c] /= pool_size;
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::ChannelLastBackward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  const int num = top[0]->num();
+  const int bottom_dim = height_ * width_ * channels_;
+  const int top_dim = pooled_height_ * pooled_width_ * channels_;
+  const bool use_max =
+      this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX;
+  const int* mask = use_max ? max_idx_.cpu_data() : NULL;
+  // Windows overlap only within an image, so images are independent.
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int n = 0; n < num; ++n) {
+    Dtype* image_diff = bottom_diff + n * bottom_dim;
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        const int pool_index =
+            n * top_dim + (ph * pooled_width_ + pw) * channels_;
+        const Dtype* out_diff = top_diff + pool_index;
+        if (use_max) {
+          const int* out_mask = mask + pool_index;
+          for (int c = 0; c < channels_; ++c) {
+            image_diff[out_mask[c] * channels_ + c] += out_diff[c];
+          }
+          continue;
+        }
+        int hstart = ph * stride_h_ - pad_h_;
+        int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_ + pad_h_);
+        int wend = min(wstart + kernel_w_, width_ + pad_w_);
+        const int pool_size = (hend - hstart) * (wend - wstart);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        hend = min(hend, height_);
+        wend = min(wend, width_);
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            Dtype* in_diff = image_diff + (h * width_ + w) * channels_;
+            for (int c = 0; c < channels_; ++c) {
+              in_diff[c] += out_diff[c] / pool_size;
+            }
+          }
+        }
+      }
+    }
+  }
+}
 
 #ifdef CPU_ONLY
 STUB_GPU(PoolingLayer);
@@ -0,0 +1,334 @@
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/highgui/highgui_c.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/fast_rcnn_layers.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+ROIDataLayer<Dtype>::~ROIDataLayer<Dtype>() {
+  this->StopInternalThread();
+}
+
+template <typename Dtype>
+void ROIDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const ROIDataParameter& roi_data_param = this->layer_param_.roi_data_param();
+  const int ims_per_batch = roi_data_param.ims_per_batch();
+  const int batch_size = roi_data_param.batch_size();
+  const int num_classes = roi_data_param.num_classes();
+  CHECK_GT(ims_per_batch, 0);
+  CHECK_EQ(batch_size % ims_per_batch, 0)
+      << "batch_size must be a multiple of ims_per_batch.";
+  CHECK_GT(num_classes, 1) << "num_classes must include the background.";
+  CHECK(!this->transform_param_.has_mean_file())
+      << "ROIDataLayer only subtracts mean_value.";
+  CHECK_EQ(this->transform_param_.crop_size(), 0)
+      << "ROIDataLayer does not crop.";
+
+  // Read the roidb file.
+  const string& source = roi_data_param.source();
+  LOG(INFO) << "Opening file " << source;
+  std::ifstream infile(source.c_str());
+  CHECK(infile.good()) << "Failed to open roidb file " << source;
+  string hashtag;
+  int image_index;
+  while (infile >> hashtag >> image_index) {
+    CHECK_EQ(hashtag, "#");
+    string image_path;
+    int num_rois;
+    infile >> image_path >> num_rois;
+    vector<float> rois(num_rois * NUM);
+    for (int i = 0; i < rois.size(); ++i) {
+      infile >> rois[i];
+    }
+    CHECK(infile) << "Failed to read the ROIs of " << image_path;
+    image_paths_.push_back(roi_data_param.root_folder() + image_path);
+    image_rois_.push_back(rois);
+  }
+  CHECK(!image_paths_.empty()) << "roidb file is empty";
+  LOG(INFO) << "A total of " << image_paths_.size() << " images.";
+
+  const unsigned int prefetch_rng_seed = caffe_rng_rand();
+  prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+  image_order_.resize(image_paths_.size());
+  for (int i = 0; i < image_order_.size(); ++i) {
+    image_order_[i] = i;
+  }
+  if (roi_data_param.shuffle()) {
+    LOG(INFO) << "Shuffling data";
+    ShuffleImages();
+  }
+  image_cursor_ = 0;
+
+  const int channels = 3;
+  const int mean_value_size = this->transform_param_.mean_value_size();
+  CHECK(mean_value_size == 0 || mean_value_size == 1 ||
+      mean_value_size == channels) <<
+      "Specify either 1 mean_value or as many as channels: " << channels;
+  for (int c = 0; c < channels; ++c) {
+    mean_values_.push_back(mean_value_size == 0 ? 0 :
+        this->transform_param_.mean_value(mean_value_size == 1 ? 0 : c));
+  }
+
+  // The shape of data and the number of ROIs change with every batch; start
+  // from the largest, so that the prefetch thread never has to grow the
+  // blobs. A batch mixing landscape and portrait images is max_size wide and
+  // high.
+  const int max_size = roi_data_param.max_size();
+  top[0]->Reshape(ims_per_batch, channels, max_size, max_size);
+  vector<int> rois_shape(2, batch_size);
+  rois_shape[1] = 5;
+  top[1]->Reshape(rois_shape);
+  vector<int> label_shape(1, batch_size);
+  top[2]->Reshape(label_shape);
+  vector<int> bbox_shape(2, batch_size);
+  bbox_shape[1] = 4 * num_classes;
+  for (int i = 3; i < top.size(); ++i) {
+    top[i]->Reshape(bbox_shape);
+  }
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*top[0]);
+    this->prefetch_[i]->label_.Reshape(label_shape);
+    prefetch_rois_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>(rois_shape)));
+    prefetch_bbox_targets_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>(bbox_shape)));
+    prefetch_bbox_weights_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>(bbox_shape)));
+  }
+  LOG(INFO) << "output data size: " << top[0]->num() << ","
+      << top[0]->channels() << "," << top[0]->height() << ","
+      << top[0]->width();
+}
+
+template <typename Dtype>
+void ROIDataLayer<Dtype>::ShuffleImages() {
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(image_order_.begin(), image_order_.end(), prefetch_rng);
+}
+
+template <typename Dtype>
+unsigned int ROIDataLayer<Dtype>::PrefetchRand() {
+  CHECK(prefetch_rng_);
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  return (*prefetch_rng)();
+}
+
+template <typename Dtype>
+void ROIDataLayer<Dtype>::SampleROIs(int image_id, int batch_index,
+    Dtype im_scale, bool do_mirror, int image_width, vector<Dtype>* rois,
+    vector<Dtype>* labels, vector<Dtype>* bbox_targets) {
+  const ROIDataParameter& roi_data_param = this->layer_param_.roi_data_param();
+  const int rois_per_image =
+      roi_data_param.batch_size() / roi_data_param.ims_per_batch();
+  const int fg_rois_per_image =
+      static_cast<int>(round(roi_data_param.fg_fraction() * rois_per_image));
+  const vector<float>& image_rois = image_rois_[image_id];
+  vector<int> fg_rois;
+  vector<int> bg_rois;
+  for (int i = 0; i < image_rois.size() / NUM; ++i) {
+    const float overlap = image_rois[i * NUM + OVERLAP];
+    if (overlap >= roi_data_param.fg_threshold()) {
+      fg_rois.push_back(i);
+    } else if (overlap < roi_data_param.bg_threshold_hi() &&
+        overlap >= roi_data_param.bg_threshold_lo()) {
+      bg_rois.push_back(i);
+    }
+  }
+  // Sample without replacement: fg first, then bg to fill the image's share.
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(fg_rois.begin(), fg_rois.end(), prefetch_rng);
+  shuffle(bg_rois.begin(), bg_rois.end(), prefetch_rng);
+  const int num_fg = std::min<int>(fg_rois_per_image, fg_rois.size());
+  const int num_bg = std::min<int>(rois_per_image - num_fg, bg_rois.size());
+  fg_rois.resize(num_fg);
+  fg_rois.insert(fg_rois.end(), bg_rois.begin(), bg_rois.begin() + num_bg);
+  for (int i = 0; i < fg_rois.size(); ++i) {
+    const float* roi = &image_rois[fg_rois[i] * NUM];
+    Dtype x1 = roi[X1];
+    Dtype x2 = roi[X2];
+    Dtype tx = roi[TX];
+    if (do_mirror) {
+      x1 = image_width - roi[X2] - 1;
+      x2 = image_width - roi[X1] - 1;
+      tx = -tx;
+    }
+    rois->push_back(batch_index);
+    rois->push_back(x1 * im_scale);
+    rois->push_back(roi[Y1] * im_scale);
+    rois->push_back(x2 * im_scale);
+    rois->push_back(roi[Y2] * im_scale);
+    labels->push_back(i < num_fg ? roi[LABEL] : 0);
+    bbox_targets->push_back(tx);
+    bbox_targets->push_back(roi[TY]);
+    bbox_targets->push_back(roi[TW]);
+    bbox_targets->push_back(roi[TH]);
+  }
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void ROIDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+  CPUTimer batch_timer;
+  batch_timer.Start();
+  double read_time = 0;
+  double trans_time = 0;
+  CPUTimer timer;
+  const ROIDataParameter& roi_data_param = this->layer_param_.roi_data_param();
+  const int ims_per_batch = roi_data_param.ims_per_batch();
+  const int num_classes = roi_data_param.num_classes();
+  const int max_size = roi_data_param.max_size();
+  const int channels = 3;
+  const int index = BatchIndex(batch);
+
+  // Load the images, resize them and sample their ROIs.
+  vector<cv::Mat> images(ims_per_batch);
+  vector<Dtype> rois;
+  vector<Dtype> labels;
+  vector<Dtype> targets;
+  int height = 0;
+  int width = 0;
+  for (int item_id = 0; item_id < ims_per_batch; ++item_id) {
+    timer.Start();
+    const int image_id = image_order_[image_cursor_];
+    cv::Mat cv_img = cv::imread(image_paths_[image_id], CV_LOAD_IMAGE_COLOR);
+    CHECK(cv_img.data) << "Could not load " << image_paths_[image_id];
+    read_time += timer.MicroSeconds();
+    timer.Start();
+    const int scale = roi_data_param.scales_size() ?
+        roi_data_param.scales(PrefetchRand() % roi_data_param.scales_size()) :
+        600;
+    const bool do_mirror = this->transform_param_.mirror() &&
+        PrefetchRand() % 2;
+    // Scale the shorter side to scale, unless the longer one gets too long.
+    const int size_min = std::min(cv_img.rows, cv_img.cols);
+    const int size_max = std::max(cv_img.rows, cv_img.cols);
+    Dtype im_scale = static_cast<Dtype>(scale) / size_min;
+    if (round(im_scale * size_max) > max_size) {
+      im_scale = static_cast<Dtype>(max_size) / size_max;
+    }
+    cv::resize(cv_img, images[item_id],
+        cv::Size(static_cast<int>(round(cv_img.cols * im_scale)),
+                 static_cast<int>(round(cv_img.rows * im_scale))),
+        0, 0, cv::INTER_LINEAR);
+    if (do_mirror) {
+      cv::flip(images[item_id], images[item_id], 1);
+    }
+    height = std::max(height, images[item_id].rows);
+    width = std::max(width, images[item_id].cols);
+    SampleROIs(image_id, item_id, im_scale, do_mirror, cv_img.cols, &rois,
+        &labels, &targets);
+    trans_time += timer.MicroSeconds();
+    // go to the next image
+    if (++image_cursor_ == image_order_.size()) {
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      image_cursor_ = 0;
+      if (roi_data_param.shuffle()) {
+        ShuffleImages();
+      }
+    }
+  }
+
+  // Copy the images into the top left corner of the zeroed data.
+  timer.Start();
+  batch->data_.Reshape(ims_per_batch, channels, height, width);
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  caffe_set(batch->data_.count(), Dtype(0), top_data);
+  const Dtype scale = this->transform_param_.scale();
+  for (int item_id = 0; item_id < ims_per_batch; ++item_id) {
+    const cv::Mat& image = images[item_id];
+    for (int h = 0; h < image.rows; ++h) {
+      const uchar* ptr = image.ptr<uchar>(h);
+      int img_index = 0;
+      for (int w = 0; w < image.cols; ++w) {
+        for (int c = 0; c < channels; ++c) {
+          const int top_index = ((item_id * channels + c) * height + h)
+              * width + w;
+          top_data[top_index] =
+              (static_cast<Dtype>(ptr[img_index++]) - mean_values_[c]) * scale;
+        }
+      }
+    }
+  }
+
+  // Copy the ROIs, and spread their targets to the slots of their labels.
+  const int num_rois = labels.size();
+  CHECK_GT(num_rois, 0) << "No ROI of the batch is foreground or background.";
+  vector<int> rois_shape(2, num_rois);
+  rois_shape[1] = 5;
+  prefetch_rois_[index]->Reshape(rois_shape);
+  caffe_copy(rois.size(), rois.data(),
+      prefetch_rois_[index]->mutable_cpu_data());
+  batch->label_.Reshape(vector<int>(1, num_rois));
+  caffe_copy(num_rois, labels.data(), batch->label_.mutable_cpu_data());
+  vector<int> bbox_shape(2, num_rois);
+  bbox_shape[1] = 4 * num_classes;
+  prefetch_bbox_targets_[index]->Reshape(bbox_shape);
+  prefetch_bbox_weights_[index]->Reshape(bbox_shape);
+  Dtype* bbox_targets = prefetch_bbox_targets_[index]->mutable_cpu_data();
+  Dtype* bbox_weights = prefetch_bbox_weights_[index]->mutable_cpu_data();
+  caffe_set(prefetch_bbox_targets_[index]->count(), Dtype(0), bbox_targets);
+  caffe_set(prefetch_bbox_weights_[index]->count(), Dtype(0), bbox_weights);
+  for (int i = 0; i < num_rois; ++i) {
+    const int label = static_cast<int>(labels[i]);
+    CHECK_LT(label, num_classes);
+    if (label > 0) {
+      for (int k = 0; k < 4; ++k) {
+        bbox_targets[i * 4 * num_classes + 4 * label + k] = targets[i * 4 + k];
+        bbox_weights[i * 4 * num_classes + 4 * label + k] = 1;
+      }
+    }
+  }
+  trans_time += timer.MicroSeconds();
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
+  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
+  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+}
+
+template <typename Dtype>
+int ROIDataLayer<Dtype>::BatchIndex(const Batch<Dtype>* batch) const {
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    if (this->prefetch_[i].get() == batch) {
+      return i;
+    }
+  }
+  LOG(FATAL) << "Batch not prefetched by " << this->layer_param_.name();
+  return -1;
+}
+
+template <typename Dtype>
+void ROIDataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  Batch<Dtype>* batch = this->next_batch();
+  const int index = BatchIndex(batch);
+  this->OutputPrefetched(&batch->data_, top[0]);
+  this->OutputPrefetched(prefetch_rois_[index].get(), top[1]);
+  this->OutputPrefetched(&batch->label_, top[2]);
+  if (top.size() > 3) {
+    this->OutputPrefetched(prefetch_bbox_targets_[index].get(), top[3]);
+  }
+  if (top.size() > 4) {
+    this->OutputPrefetched(prefetch_bbox_weights_[index].get(), top[4]);
+  }
+  this->prefetch_free_.push(batch);
+}
+
+INSTANTIATE_CLASS(ROIDataLayer);
+REGISTER_LAYER_CLASS(ROIData);
+
+}  // namespace caffe
@@ -6,6 +6,7 @@
 // ------------------------------------------------------------------
 
 #include <cfloat>
+#include <vector>
 
 #include "caffe/fast_rcnn_layers.hpp"
 
@@ -28,6 +29,16 @@ void ROIPoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   pooled_width_ = roi_pool_param.pooled_w();
   spatial_scale_ = roi_pool_param.spatial_scale();
   LOG(INFO) << "Spatial scale: " << spatial_scale_;
+  sampling_ratio_ = roi_pool_param.sampling_ratio();
+  if (roi_pool_param.pool() == ROIPoolingParameter_PoolMethod_ALIGN) {
+    CHECK_GT(sampling_ratio_, 0) << "sampling_ratio must be > 0";
+    CHECK_EQ(Caffe::mode(), Caffe::CPU)
+        << "ALIGN ROI pooling is only implemented on the CPU.";
+  }
+  if (this->layer_param_.layout() == NHWC) {
+    CHECK_EQ(Caffe::mode(), Caffe::CPU)
+        << "NHWC layout is only implemented on the CPU.";
+  }
 }
 
 template <typename Dtype>
@@ -40,31 +51,131 @@ void ROIPoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       pooled_width_);
   max_idx_.Reshape(bottom[1]->num(), channels_, pooled_height_,
       pooled_width_);
+  if (this->layer_param_.roi_pooling_param().pool() ==
+      ROIPoolingParameter_PoolMethod_ALIGN) {
+    vector<int> table_shape(3);
+    table_shape[0] = bottom[1]->num();
+    table_shape[1] = pooled_height_ * pooled_width_;
+    table_shape[2] = sampling_ratio_ * sampling_ratio_ * 4;
+    sample_index_.Reshape(table_shape);
+    sample_weight_.Reshape(table_shape);
+  }
+}
+
+// Largest element of row[0, len) that compares greater than -FLT_MAX, or
+// -FLT_MAX if there is none. Four independent accumulators break the compare
+// chain so the compiler can keep them in one vector register; the lane order
+// only matters for the value, never for which index the caller picks.
+template <typename Dtype>
+static inline Dtype roi_pool_row_max(const Dtype* row, const int len) {
+  Dtype m0 = -FLT_MAX, m1 = -FLT_MAX, m2 = -FLT_MAX, m3 = -FLT_MAX;
+  int i = 0;
+  for (; i + 4 <= len; i += 4) {
+    m0 = row[i] > m0 ? row[i] : m0;
+    m1 = row[i + 1] > m1 ? row[i + 1] : m1;
+    m2 = row[i + 2] > m2 ? row[i + 2] : m2;
+    m3 = row[i + 3] > m3 ? row[i + 3] : m3;
+  }
+  for (; i < len; ++i) {
+    m0 = row[i] > m0 ? row[i] : m0;
+  }
+  m0 = m1 > m0 ? m1 : m0;
+  m2 = m3 > m2 ? m3 : m2;
+  return m2 > m0 ? m2 : m0;
+}
+
+// Max pool one bin [hstart, hend) x [wstart, wend) of a channel plane. The
+// result is identical to a row-major scalar scan with a strict '>': the first
+// element holding the maximum wins, and an empty bin yields (0, -1).
+template <typename Dtype>
+static inline void roi_pool_bin(const Dtype* data, const int width,
+    const int hstart, const int hend, const int wstart, const int wend,
+    Dtype* top, int* argmax) {
+  if (hend <= hstart || wend <= wstart) {
+    *top = 0;
+    *argmax = -1;
+    return;
+  }
+  Dtype maxval = -FLT_MAX;
+  int maxidx = -1;
+  for (int h = hstart; h < hend; ++h) {
+    const Dtype* row = data + h * width + wstart;
+    const Dtype row_max = roi_pool_row_max(row, wend - wstart);
+    if (row_max > maxval) {
+      int w = 0;
+      while (!(row[w] == row_max)) {
+        ++w;
+      }
+      maxval = row[w];
+      maxidx = h * width + wstart + w;
+    }
+  }
+  *top = maxval;
+  *argmax = maxidx;
 }
 
+// roi_pool_bin for a channel-last image: pools all channels of the bin at
+// once, with the same first-wins tie rule per channel. argmax holds pixel
+// indices h * width + w, as in the NCHW case.
+template <typename Dtype>
+static inline void roi_pool_bin_channel_last(const Dtype* data,
+    const int width, const int channels, const int hstart, const int hend,
+    const int wstart, const int wend, Dtype* top, int* argmax) {
+  const bool is_empty = (hend <= hstart) || (wend <= wstart);
+  for (int c = 0; c < channels; ++c) {
+    top[c] = is_empty ? Dtype(0) : Dtype(-FLT_MAX);
+    argmax[c] = -1;
+  }
+  for (int h = hstart; h < hend; ++h) {
+    for (int w = wstart; w < wend; ++w) {
+      const int index = h * width + w;
+      const Dtype* pixel = data + index * channels;
+      for (int c = 0; c < channels; ++c) {
+        if (pixel[c] > top[c]) {
+          top[c] = pixel[c];
+          argmax[c] = index;
+        }
+      }
+    }
+  }
+}
+
+// Channels handled together by one thread in the channel-last backward
+// passes, so that each scattered write fills a run of a cache line.
+static const int kChannelBlock = 16;
+
 template <typename Dtype>
 void ROIPoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (this->layer_param_.roi_pooling_param().pool() ==
+      ROIPoolingParameter_PoolMethod_ALIGN) {
+    AlignForward_cpu(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* bottom_rois = bottom[1]->cpu_data();
   // Number of ROIs
-  int num_rois = bottom[1]->num();
-  int batch_size = bottom[0]->num();
-  int top_count = top[0]->count();
+  const int num_rois = bottom[1]->num();
+  const int batch_size = bottom[0]->num();
+  const int pooled_count = pooled_height_ * pooled_width_;
   Dtype* top_data = top[0]->mutable_cpu_data();
-  caffe_set(top_count, Dtype(-FLT_MAX), top_data);
   int* argmax_data = max_idx_.mutable_cpu_data();
-  caffe_set(top_count, -1, argmax_data);
 
-  // For each ROI R = [batch_index x1 y1 x2 y2]: max pool over R
+  // The pooling windows of an ROI are the same for every channel, so compute
+  // them once per ROI as [hstart, hend, wstart, wend] for each output unit.
+  vector<int> roi_batch_inds(num_rois);
+  vector<int> bins(num_rois * pooled_count * 4);
   for (int n = 0; n < num_rois; ++n) {
-    int roi_batch_ind = bottom_rois[0];
-    int roi_start_w = round(bottom_rois[1] * spatial_scale_);
-    int roi_start_h = round(bottom_rois[2] * spatial_scale_);
-    int roi_end_w = round(bottom_rois[3] * spatial_scale_);
-    int roi_end_h = round(bottom_rois[4] * spatial_scale_);
+    // For each ROI R = [batch_index x1 y1 x2 y2]: max pool over R
+    const Dtype* roi = bottom_rois + bottom[1]->offset(n);
+    int roi_batch_ind = roi[0];
+    int roi_start_w = round(roi[1] * spatial_scale_);
+    int roi_start_h = round(roi[2] * spatial_scale_);
+    int roi_end_w = round(roi[3] * spatial_scale_);
+    int roi_end_h = round(roi[4] * spatial_scale_);
     CHECK_GE(roi_batch_ind, 0);
     CHECK_LT(roi_batch_ind, batch_size);
+    roi_batch_inds[n] = roi_batch_ind;
 
     int roi_height = max(roi_end_h - roi_start_h + 1, 1);
     int roi_width = max(roi_end_w - roi_start_w + 1, 1);
@@ -73,63 +184,355 @@ void ROIPoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const Dtype bin_size_w = static_cast<Dtype>(roi_width)
                              / static_cast<Dtype>(pooled_width_);
 
-    const Dtype* batch_data = bottom_data + bottom[0]->offset(roi_batch_ind);
-
-    for (int c = 0; c < channels_; ++c) {
-      for (int ph = 0; ph < pooled_height_; ++ph) {
-        for (int pw = 0; pw < pooled_width_; ++pw) {
-          // Compute pooling region for this output unit:
-          //  start (included) = floor(ph * roi_height / pooled_height_)
-          //  end (excluded) = ceil((ph + 1) * roi_height / pooled_height_)
-          int hstart = static_cast<int>(floor(static_cast<Dtype>(ph)
-                                              * bin_size_h));
-          int wstart = static_cast<int>(floor(static_cast<Dtype>(pw)
-                                              * bin_size_w));
-          int hend = static_cast<int>(ceil(static_cast<Dtype>(ph + 1)
-                                           * bin_size_h));
-          int wend = static_cast<int>(ceil(static_cast<Dtype>(pw + 1)
-                                           * bin_size_w));
-
-          hstart = min(max(hstart + roi_start_h, 0), height_);
-          hend = min(max(hend + roi_start_h, 0), height_);
-          wstart = min(max(wstart + roi_start_w, 0), width_);
-          wend = min(max(wend + roi_start_w, 0), width_);
-
-          bool is_empty = (hend <= hstart) || (wend <= wstart);
-
-          const int pool_index = ph * pooled_width_ + pw;
-          if (is_empty) {
-            top_data[pool_index] = 0;
-            argmax_data[pool_index] = -1;
+    int* bin = &bins[n * pooled_count * 4];
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        // Compute pooling region for this output unit:
+        //  start (included) = floor(ph * roi_height / pooled_height_)
+        //  end (excluded) = ceil((ph + 1) * roi_height / pooled_height_)
+        int hstart = static_cast<int>(floor(static_cast<Dtype>(ph)
+                                            * bin_size_h));
+        int wstart = static_cast<int>(floor(static_cast<Dtype>(pw)
+                                            * bin_size_w));
+        int hend = static_cast<int>(ceil(static_cast<Dtype>(ph + 1)
+                                         * bin_size_h));
+        int wend = static_cast<int>(ceil(static_cast<Dtype>(pw + 1)
+                                         * bin_size_w));
+
+        bin[0] = min(max(hstart + roi_start_h, 0), height_);
+        bin[1] = min(max(hend + roi_start_h, 0), height_);
+        bin[2] = min(max(wstart + roi_start_w, 0), width_);
+        bin[3] = min(max(wend + roi_start_w, 0), width_);
+        bin += 4;
+      }
+    }
+  }
+
+  const int spatial_dim = height_ * width_;
+  if (this->layer_param_.layout() == NHWC) {
+    // Every (ROI, bin) pair writes the channel vector of one output pixel.
+    const int num_tasks = num_rois * pooled_count;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int task = 0; task < num_tasks; ++task) {
+      const int n = task / pooled_count;
+      const Dtype* image_data = bottom_data
+          + roi_batch_inds[n] * spatial_dim * channels_;
+      const int* bin = &bins[task * 4];
+      roi_pool_bin_channel_last(image_data, width_, channels_, bin[0], bin[1],
+          bin[2], bin[3], top_data + task * channels_,
+          argmax_data + task * channels_);
+    }
+    return;
+  }
+
+  // Every (ROI, channel) pair writes its own slice of top and max_idx_.
+  const int num_tasks = num_rois * channels_;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int task = 0; task < num_tasks; ++task) {
+    const int n = task / channels_;
+    const int c = task % channels_;
+    const Dtype* channel_data = bottom_data
+        + (roi_batch_inds[n] * channels_ + c) * spatial_dim;
+    const int* bin = &bins[n * pooled_count * 4];
+    Dtype* channel_top = top_data + task * pooled_count;
+    int* channel_argmax = argmax_data + task * pooled_count;
+    for (int i = 0; i < pooled_count; ++i, bin += 4) {
+      roi_pool_bin(channel_data, width_, bin[0], bin[1], bin[2], bin[3],
+          channel_top + i, channel_argmax + i);
+    }
+  }
+}
+
+template <typename Dtype>
+void ROIPoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  if (this->layer_param_.roi_pooling_param().pool() ==
+      ROIPoolingParameter_PoolMethod_ALIGN) {
+    AlignBackward_cpu(top, propagate_down, bottom);
+    return;
+  }
+  const Dtype* bottom_rois = bottom[1]->cpu_data();
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  caffe_set(bottom[0]->count(), Dtype(0.), bottom_diff);
+  const int* argmax_data = max_idx_.cpu_data();
+  const int num_rois = top[0]->num();
+  const int pooled_count = pooled_height_ * pooled_width_;
+  const int spatial_dim = height_ * width_;
+
+  if (this->layer_param_.layout() == NHWC) {
+    const int num_blocks = (channels_ + kChannelBlock - 1) / kChannelBlock;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int block = 0; block < num_blocks; ++block) {
+      const int c_start = block * kChannelBlock;
+      const int c_end = min(c_start + kChannelBlock, channels_);
+      for (int n = 0; n < num_rois; ++n) {
+        const int roi_batch_ind = bottom_rois[bottom[1]->offset(n)];
+        Dtype* image_diff = bottom_diff
+            + roi_batch_ind * spatial_dim * channels_;
+        for (int i = 0; i < pooled_count; ++i) {
+          const int offset = (n * pooled_count + i) * channels_;
+          for (int c = c_start; c < c_end; ++c) {
+            const int bottom_index = argmax_data[offset + c];
+            if (bottom_index >= 0) {
+              image_diff[bottom_index * channels_ + c] += top_diff[offset + c];
+            }
           }
+        }
+      }
+    }
+    return;
+  }
 
-          for (int h = hstart; h < hend; ++h) {
-            for (int w = wstart; w < wend; ++w) {
-              const int index = h * width_ + w;
-              if (batch_data[index] > top_data[pool_index]) {
-                top_data[pool_index] = batch_data[index];
-                argmax_data[pool_index] = index;
+  // Route each output gradient to the element that won its max. A channel
+  // plane of bottom_diff is only ever touched by the thread that owns that
+  // channel, and ROIs are accumulated in order, so the scatter needs no
+  // atomics and the sums do not depend on the number of threads.
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int c = 0; c < channels_; ++c) {
+    for (int n = 0; n < num_rois; ++n) {
+      const int roi_batch_ind = bottom_rois[bottom[1]->offset(n)];
+      Dtype* channel_diff = bottom_diff
+          + (roi_batch_ind * channels_ + c) * spatial_dim;
+      const int offset = (n * channels_ + c) * pooled_count;
+      const Dtype* channel_top_diff = top_diff + offset;
+      const int* channel_argmax = argmax_data + offset;
+      for (int i = 0; i < pooled_count; ++i) {
+        const int bottom_index = channel_argmax[i];
+        if (bottom_index >= 0) {
+          channel_diff[bottom_index] += channel_top_diff[i];
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ROIPoolingLayer<Dtype>::ComputeSamplingTables(const Blob<Dtype>& rois) {
+  const int num_rois = rois.num();
+  const int samples = sampling_ratio_ * sampling_ratio_;
+  const Dtype sample_scale = Dtype(1) / samples;
+  int* index = sample_index_.mutable_cpu_data();
+  Dtype* weight = sample_weight_.mutable_cpu_data();
+  for (int n = 0; n < num_rois; ++n) {
+    const Dtype* roi = rois.cpu_data() + rois.offset(n);
+    // Unlike MAX mode the box is not rounded to the feature map grid
+    const Dtype roi_start_w = roi[1] * spatial_scale_;
+    const Dtype roi_start_h = roi[2] * spatial_scale_;
+    const Dtype roi_end_w = roi[3] * spatial_scale_;
+    const Dtype roi_end_h = roi[4] * spatial_scale_;
+    // Force malformed ROIs to be 1x1
+    const Dtype roi_width = max(roi_end_w - roi_start_w, Dtype(1));
+    const Dtype roi_height = max(roi_end_h - roi_start_h, Dtype(1));
+    const Dtype bin_size_h = roi_height / static_cast<Dtype>(pooled_height_);
+    const Dtype bin_size_w = roi_width / static_cast<Dtype>(pooled_width_);
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        for (int iy = 0; iy < sampling_ratio_; ++iy) {
+          Dtype y = roi_start_h + ph * bin_size_h
+              + (iy + Dtype(.5)) * bin_size_h / sampling_ratio_;
+          for (int ix = 0; ix < sampling_ratio_; ++ix) {
+            Dtype x = roi_start_w + pw * bin_size_w
+                + (ix + Dtype(.5)) * bin_size_w / sampling_ratio_;
+            // Samples more than one pixel off the map contribute nothing
+            if (y < -1 || y > height_ || x < -1 || x > width_) {
+              for (int k = 0; k < 4; ++k) {
+                index[k] = 0;
+                weight[k] = 0;
               }
+              index += 4;
+              weight += 4;
+              continue;
             }
+            y = max(y, Dtype(0));
+            x = max(x, Dtype(0));
+            int y_low = static_cast<int>(y);
+            int x_low = static_cast<int>(x);
+            int y_high, x_high;
+            if (y_low >= height_ - 1) {
+              y_high = y_low = height_ - 1;
+              y = static_cast<Dtype>(y_low);
+            } else {
+              y_high = y_low + 1;
+            }
+            if (x_low >= width_ - 1) {
+              x_high = x_low = width_ - 1;
+              x = static_cast<Dtype>(x_low);
+            } else {
+              x_high = x_low + 1;
+            }
+            const Dtype ly = y - y_low;
+            const Dtype lx = x - x_low;
+            const Dtype hy = 1 - ly;
+            const Dtype hx = 1 - lx;
+            index[0] = y_low * width_ + x_low;
+            index[1] = y_low * width_ + x_high;
+            index[2] = y_high * width_ + x_low;
+            index[3] = y_high * width_ + x_high;
+            weight[0] = hy * hx * sample_scale;
+            weight[1] = hy * lx * sample_scale;
+            weight[2] = ly * hx * sample_scale;
+            weight[3] = ly * lx * sample_scale;
+            index += 4;
+            weight += 4;
           }
         }
       }
-      // Increment all data pointers by one channel
-      batch_data += bottom[0]->offset(0, 1);
-      top_data += top[0]->offset(0, 1);
-      argmax_data += max_idx_.offset(0, 1);
     }
-    // Increment ROI data pointer
-    bottom_rois += bottom[1]->offset(1);
   }
 }
 
 template <typename Dtype>
-void ROIPoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+void ROIPoolingLayer<Dtype>::AlignForward_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* bottom_rois = bottom[1]->cpu_data();
+  const int num_rois = bottom[1]->num();
+  const int batch_size = bottom[0]->num();
+  for (int n = 0; n < num_rois; ++n) {
+    const int roi_batch_ind = bottom_rois[bottom[1]->offset(n)];
+    CHECK_GE(roi_batch_ind, 0);
+    CHECK_LT(roi_batch_ind, batch_size);
+  }
+  ComputeSamplingTables(*bottom[1]);
+  const int* sample_index = sample_index_.cpu_data();
+  const Dtype* sample_weight = sample_weight_.cpu_data();
+  const int taps = sample_index_.shape(2);
+  const int pooled_count = pooled_height_ * pooled_width_;
+  const int spatial_dim = height_ * width_;
+  Dtype* top_data = top[0]->mutable_cpu_data();
+
+  if (this->layer_param_.layout() == NHWC) {
+    const int num_tasks = num_rois * pooled_count;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int task = 0; task < num_tasks; ++task) {
+      const int n = task / pooled_count;
+      const int roi_batch_ind = bottom_rois[bottom[1]->offset(n)];
+      const Dtype* image_data = bottom_data
+          + roi_batch_ind * spatial_dim * channels_;
+      const int* index = sample_index + task * taps;
+      const Dtype* weight = sample_weight + task * taps;
+      Dtype* out = top_data + task * channels_;
+      for (int c = 0; c < channels_; ++c) {
+        out[c] = 0;
+      }
+      for (int k = 0; k < taps; ++k) {
+        const Dtype* pixel = image_data + index[k] * channels_;
+        for (int c = 0; c < channels_; ++c) {
+          out[c] += weight[k] * pixel[c];
+        }
+      }
+    }
+    return;
+  }
+
+  const int num_tasks = num_rois * channels_;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int task = 0; task < num_tasks; ++task) {
+    const int n = task / channels_;
+    const int c = task % channels_;
+    const int roi_batch_ind = bottom_rois[bottom[1]->offset(n)];
+    const Dtype* channel_data = bottom_data
+        + (roi_batch_ind * channels_ + c) * spatial_dim;
+    const int* index = sample_index + n * pooled_count * taps;
+    const Dtype* weight = sample_weight + n * pooled_count * taps;
+    Dtype* channel_top = top_data + task * pooled_count;
+    for (int i = 0; i < pooled_count; ++i) {
+      Dtype val = 0;
+      for (int k = 0; k < taps; ++k) {
+        val += weight[k] * channel_data[index[k]];
+      }
+      channel_top[i] = val;
+      index += taps;
+      weight += taps;
+    }
+  }
 }
 
+template <typename Dtype>
+void ROIPoolingLayer<Dtype>::AlignBackward_cpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  // sample_index_ and sample_weight_ still hold the tables from forward
+  const Dtype* bottom_rois = bottom[1]->cpu_data();
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  caffe_set(bottom[0]->count(), Dtype(0.), bottom_diff);
+  const int* sample_index = sample_index_.cpu_data();
+  const Dtype* sample_weight = sample_weight_.cpu_data();
+  const int taps = sample_index_.shape(2);
+  const int num_rois = top[0]->num();
+  const int pooled_count = pooled_height_ * pooled_width_;
+  const int spatial_dim = height_ * width_;
+
+  if (this->layer_param_.layout() == NHWC) {
+    const int num_blocks = (channels_ + kChannelBlock - 1) / kChannelBlock;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int block = 0; block < num_blocks; ++block) {
+      const int c_start = block * kChannelBlock;
+      const int c_end = min(c_start + kChannelBlock, channels_);
+      for (int n = 0; n < num_rois; ++n) {
+        const int roi_batch_ind = bottom_rois[bottom[1]->offset(n)];
+        Dtype* image_diff = bottom_diff
+            + roi_batch_ind * spatial_dim * channels_;
+        for (int i = 0; i < pooled_count; ++i) {
+          const int task = n * pooled_count + i;
+          const int* index = sample_index + task * taps;
+          const Dtype* weight = sample_weight + task * taps;
+          const Dtype* out_diff = top_diff + task * channels_;
+          for (int k = 0; k < taps; ++k) {
+            Dtype* pixel_diff = image_diff + index[k] * channels_;
+            for (int c = c_start; c < c_end; ++c) {
+              pixel_diff[c] += weight[k] * out_diff[c];
+            }
+          }
+        }
+      }
+    }
+    return;
+  }
+
+  // As in MAX mode, one thread owns each channel plane of bottom_diff.
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int c = 0; c < channels_; ++c) {
+    for (int n = 0; n < num_rois; ++n) {
+      const int roi_batch_ind = bottom_rois[bottom[1]->offset(n)];
+      Dtype* channel_diff = bottom_diff
+          + (roi_batch_ind * channels_ + c) * spatial_dim;
+      const Dtype* channel_top_diff = top_diff
+          + (n * channels_ + c) * pooled_count;
+      const int* index = sample_index + n * pooled_count * taps;
+      const Dtype* weight = sample_weight + n * pooled_count * taps;
+      for (int i = 0; i < pooled_count; ++i) {
+        const Dtype grad = channel_top_diff[i];
+        for (int k = 0; k < taps; ++k) {
+          channel_diff[index[k]] += weight[k] * grad;
+        }
+        index += taps;
+        weight += taps;
+      }
+    }
+  }
+}
 
 #ifdef CPU_ONLY
 STUB_GPU(ROIPoolingLayer);
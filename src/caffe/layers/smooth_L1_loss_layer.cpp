@@ -5,6 +5,8 @@
 // Written by Ross Girshick
 // ------------------------------------------------------------------
 
+#include <cmath>
+
 #include "caffe/fast_rcnn_layers.hpp"
 
 namespace caffe {
@@ -40,24 +42,76 @@ void SmoothL1LossLayer<Dtype>::Reshape(
       bottom[0]->height(), bottom[0]->width());
   errors_.Reshape(bottom[0]->num(), bottom[0]->channels(),
       bottom[0]->height(), bottom[0]->width());
-  // vector of ones used to sum
-  ones_.Reshape(bottom[0]->num(), bottom[0]->channels(),
-      bottom[0]->height(), bottom[0]->width());
-  for (int i = 0; i < bottom[0]->count(); ++i) {
-    ones_.mutable_cpu_data()[i] = Dtype(1);
-  }
 }
 
 template <typename Dtype>
 void SmoothL1LossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  NOT_IMPLEMENTED;
+  // A single pass computes, for x = w_in * (b0 - b1),
+  //   loss  += w_out * f(x)
+  //   diff_ := w_in * w_out * f'(x)
+  // where
+  //   f(x)  = 0.5 * (sigma * x)^2          if |x| < 1 / sigma / sigma
+  //           |x| - 0.5 / sigma / sigma    otherwise
+  //   f'(x) = sigma * sigma * x            if |x| < 1 / sigma / sigma
+  //           sign(x)                      otherwise
+  // so that Backward_cpu is only a scale of diff_.
+  const int count = bottom[0]->count();
+  const Dtype* b0 = bottom[0]->cpu_data();
+  const Dtype* b1 = bottom[1]->cpu_data();
+  const Dtype* w_in = has_weights_ ? bottom[2]->cpu_data() : NULL;
+  const Dtype* w_out = has_weights_ ? bottom[3]->cpu_data() : NULL;
+  Dtype* diff = diff_.mutable_cpu_data();
+  const Dtype sigma2 = sigma2_;
+  const Dtype inv_sigma2 = Dtype(1) / sigma2_;
+  const Dtype half_inv_sigma2 = Dtype(0.5) / sigma2_;
+  Dtype loss = 0;
+  if (has_weights_) {
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+: loss)
+#endif
+    for (int i = 0; i < count; ++i) {
+      const Dtype val = w_in[i] * (b0[i] - b1[i]);
+      const Dtype abs_val = std::abs(val);
+      const bool quadratic = abs_val < inv_sigma2;
+      const Dtype sign = (Dtype(0) < val) - (val < Dtype(0));
+      loss += w_out[i] * (quadratic ? Dtype(0.5) * val * val * sigma2
+                                    : abs_val - half_inv_sigma2);
+      diff[i] = w_in[i] * w_out[i] * (quadratic ? sigma2 * val : sign);
+    }
+  } else {
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+: loss)
+#endif
+    for (int i = 0; i < count; ++i) {
+      const Dtype val = b0[i] - b1[i];
+      const Dtype abs_val = std::abs(val);
+      const bool quadratic = abs_val < inv_sigma2;
+      const Dtype sign = (Dtype(0) < val) - (val < Dtype(0));
+      loss += quadratic ? Dtype(0.5) * val * val * sigma2
+                        : abs_val - half_inv_sigma2;
+      diff[i] = quadratic ? sigma2 * val : sign;
+    }
+  }
+  top[0]->mutable_cpu_data()[0] = loss / bottom[0]->num();
 }
 
 template <typename Dtype>
 void SmoothL1LossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+  // after forwards, diff_ holds w_in * w_out * f'(w_in * (b0 - b1))
+  int count = diff_.count();
+  for (int i = 0; i < 2; ++i) {
+    if (propagate_down[i]) {
+      const Dtype sign = (i == 0) ? 1 : -1;
+      const Dtype alpha = sign * top[0]->cpu_diff()[0] / bottom[i]->num();
+      caffe_cpu_scale(
+          count,                           // count
+          alpha,                           // alpha
+          diff_.cpu_data(),                // x
+          bottom[i]->mutable_cpu_diff());  // y
+    }
+  }
 }
 
 #ifdef CPU_ONLY
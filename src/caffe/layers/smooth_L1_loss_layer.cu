@@ -46,17 +46,14 @@ void SmoothL1LossLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       count, diff_.gpu_data(), errors_.mutable_gpu_data(), sigma2_);
   CUDA_POST_KERNEL_CHECK;
 
+  Dtype loss;
   if (has_weights_) {
-    // apply "outside" weights
-    caffe_gpu_mul(
-        count,
-        bottom[3]->gpu_data(),
-        errors_.gpu_data(),
-        errors_.mutable_gpu_data());  // d := w_out * SmoothL1(w_in * (b0 - b1))
+    // apply "outside" weights while summing
+    caffe_gpu_dot(count, bottom[3]->gpu_data(), errors_.gpu_data(), &loss);
+  } else {
+    // SmoothL1 is non-negative, so its sum is its L1 norm
+    caffe_gpu_asum(count, errors_.gpu_data(), &loss);
   }
-
-  Dtype loss;
-  caffe_gpu_dot(count, ones_.gpu_data(), errors_.gpu_data(), &loss);
   top[0]->mutable_cpu_data()[0] = loss / bottom[0]->num();
 }
 
@@ -0,0 +1,227 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/workspace.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// F(2x2, 3x3) works on 4x4 input tiles that overlap by two, each giving a 2x2
+// output tile; see Lavin and Gray, "Fast Algorithms for Convolutional Neural
+// Networks", 2015, for the transforms below.
+static const int kWinogradTile = 4;
+static const int kWinogradOutputTile = 2;
+static const int kWinogradTileArea = kWinogradTile * kWinogradTile;
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  transformed_memory_ = NULL;
+  use_winograd_ = this->kernel_h_ == 3 && this->kernel_w_ == 3
+      && this->stride_h_ == 1 && this->stride_w_ == 1 && this->group_ == 1
+      && this->layer_param_.layout() == NCHW;
+  if (!use_winograd_) {
+    LOG(INFO) << "Winograd convolution only covers ungrouped stride 1 3x3 "
+        << "NCHW convolution; " << this->layer_param_.name()
+        << " uses the GEMM implementation.";
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  tiles_h_ = (this->height_out_ + kWinogradOutputTile - 1)
+      / kWinogradOutputTile;
+  tiles_w_ = (this->width_out_ + kWinogradOutputTile - 1)
+      / kWinogradOutputTile;
+}
+
+// U = G g G^T for every filter g, scattered so that each of the 16 elements
+// of U forms a num_output x channels matrix.
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::transform_filters() {
+  const Blob<Dtype>& weight = *this->blobs_[0];
+  const SyncedMemory* memory = weight.data().get();
+  if (memory == transformed_memory_
+      && memory->version() == transformed_version_) {
+    return;
+  }
+  transformed_memory_ = memory;
+  transformed_version_ = memory->version();
+  const int num_output = this->num_output_;
+  const int channels = this->channels_;
+  transformed_weight_.Reshape(kWinogradTileArea, num_output, channels, 1);
+  const Dtype* g = weight.cpu_data();
+  Dtype* transformed = transformed_weight_.mutable_cpu_data();
+  const int stride = num_output * channels;
+  for (int k = 0; k < num_output; ++k) {
+    for (int c = 0; c < channels; ++c, g += 9) {
+      Dtype t[4][3];
+      for (int j = 0; j < 3; ++j) {
+        t[0][j] = g[j];
+        t[1][j] = (g[j] + g[3 + j] + g[6 + j]) / 2;
+        t[2][j] = (g[j] - g[3 + j] + g[6 + j]) / 2;
+        t[3][j] = g[6 + j];
+      }
+      Dtype* u = transformed + k * channels + c;
+      for (int i = 0; i < 4; ++i) {
+        u[(i * 4 + 0) * stride] = t[i][0];
+        u[(i * 4 + 1) * stride] = (t[i][0] + t[i][1] + t[i][2]) / 2;
+        u[(i * 4 + 2) * stride] = (t[i][0] - t[i][1] + t[i][2]) / 2;
+        u[(i * 4 + 3) * stride] = t[i][2];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::winograd_forward_cpu(
+    const Dtype* input, const Dtype* weights, Dtype* output) {
+  const int channels = this->channels_;
+  const int num_output = this->num_output_;
+  const int height = this->height_;
+  const int width = this->width_;
+  const int height_out = this->height_out_;
+  const int width_out = this->width_out_;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  // The transformed input tiles V (16 x channels x tiles) and their products
+  // with the filters M (16 x num_output x tiles) share the thread's Workspace.
+  Dtype* transformed_input = Workspace<Dtype>::Get(
+      kWinogradTileArea * (channels + num_output) * num_tiles)
+      ->mutable_cpu_data();
+  Dtype* transformed_output =
+      transformed_input + kWinogradTileArea * channels * num_tiles;
+  // V = B^T d B for every input tile d, padding with zeros. A row of tiles is
+  // transformed into a local buffer first and then copied out one tile
+  // element at a time: the 16 destinations lie channels x tiles apart, and
+  // writing them all at once thrashes the cache when that is a multiple of
+  // the page size.
+  const int input_stride = channels * num_tiles;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* data = input + c * height * width;
+    vector<Dtype> tile_row(tiles_w_ * kWinogradTileArea);
+    for (int th = 0; th < tiles_h_; ++th) {
+      const int h0 = th * kWinogradOutputTile - this->pad_h_;
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        const int w0 = tw * kWinogradOutputTile - this->pad_w_;
+        Dtype d[4][4];
+        if (h0 >= 0 && h0 + 4 <= height && w0 >= 0 && w0 + 4 <= width) {
+          for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+              d[i][j] = data[(h0 + i) * width + w0 + j];
+            }
+          }
+        } else {
+          for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+              const int h = h0 + i;
+              const int w = w0 + j;
+              d[i][j] = (h >= 0 && h < height && w >= 0 && w < width) ?
+                  data[h * width + w] : Dtype(0);
+            }
+          }
+        }
+        Dtype t[4][4];
+        for (int j = 0; j < 4; ++j) {
+          t[0][j] = d[0][j] - d[2][j];
+          t[1][j] = d[1][j] + d[2][j];
+          t[2][j] = d[2][j] - d[1][j];
+          t[3][j] = d[1][j] - d[3][j];
+        }
+        Dtype* v = &tile_row[tw * kWinogradTileArea];
+        for (int i = 0; i < 4; ++i) {
+          v[i * 4 + 0] = t[i][0] - t[i][2];
+          v[i * 4 + 1] = t[i][1] + t[i][2];
+          v[i * 4 + 2] = t[i][2] - t[i][1];
+          v[i * 4 + 3] = t[i][1] - t[i][3];
+        }
+      }
+      Dtype* v = transformed_input + c * num_tiles + th * tiles_w_;
+      for (int e = 0; e < kWinogradTileArea; ++e) {
+        for (int tw = 0; tw < tiles_w_; ++tw) {
+          v[e * input_stride + tw] = tile_row[tw * kWinogradTileArea + e];
+        }
+      }
+    }
+  }
+  // M = U V, one GEMM per tile element, summing over the channels.
+  for (int e = 0; e < kWinogradTileArea; ++e) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output, num_tiles,
+        channels, (Dtype)1., weights + e * num_output * channels,
+        transformed_input + e * input_stride, (Dtype)0.,
+        transformed_output + e * num_output * num_tiles);
+  }
+  // Y = A^T M A for every output tile, cropped to the output size. M is read
+  // a row of tiles at a time, like V was written.
+  const int output_stride = num_output * num_tiles;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int k = 0; k < num_output; ++k) {
+    Dtype* top = output + k * height_out * width_out;
+    vector<Dtype> tile_row(tiles_w_ * kWinogradTileArea);
+    for (int th = 0; th < tiles_h_; ++th) {
+      const Dtype* m_row = transformed_output + k * num_tiles + th * tiles_w_;
+      for (int e = 0; e < kWinogradTileArea; ++e) {
+        for (int tw = 0; tw < tiles_w_; ++tw) {
+          tile_row[tw * kWinogradTileArea + e] = m_row[e * output_stride + tw];
+        }
+      }
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        const Dtype* m = &tile_row[tw * kWinogradTileArea];
+        Dtype t[2][4];
+        for (int j = 0; j < 4; ++j) {
+          t[0][j] = m[j] + m[4 + j] + m[8 + j];
+          t[1][j] = m[4 + j] - m[8 + j] - m[12 + j];
+        }
+        for (int i = 0; i < 2; ++i) {
+          const int h = th * kWinogradOutputTile + i;
+          if (h >= height_out) {
+            break;
+          }
+          const int w = tw * kWinogradOutputTile;
+          top[h * width_out + w] = t[i][0] + t[i][1] + t[i][2];
+          if (w + 1 < width_out) {
+            top[h * width_out + w + 1] = t[i][1] - t[i][2] - t[i][3];
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!use_winograd_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  transform_filters();
+  const Dtype* weight = transformed_weight_.cpu_data();
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+#ifdef _OPENMP
+#pragma omp parallel for if (this->parallel_batch_)
+#endif
+    for (int n = 0; n < this->num_; ++n) {
+      winograd_forward_cpu(bottom_data + bottom[i]->offset(n), weight,
+          top_data + top[i]->offset(n));
+      if (this->bias_term_) {
+        const Dtype* bias = this->blobs_[1]->cpu_data();
+        this->forward_cpu_bias(top_data + top[i]->offset(n), bias);
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
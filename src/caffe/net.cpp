@@ -1,3 +1,5 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <algorithm>
 #include <map>
 #include <set>
@@ -13,8 +15,10 @@
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/insert_layouts.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -50,9 +54,17 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     LOG(INFO) << "Initializing net from parameters: " << std::endl
               << filtered_param.DebugString();
   }
-  // Create a copy of filtered_param with splits added where necessary.
+  // Convert to channel-last order where requested; this is CPU only.
+  if (filtered_param.layout() == NHWC && Caffe::mode() == Caffe::GPU) {
+    LOG(WARNING) << "NHWC layout is only implemented on the CPU; "
+        << "falling back to NCHW.";
+    filtered_param.set_layout(NCHW);
+  }
+  NetParameter layout_param;
+  InsertLayouts(filtered_param, &layout_param);
+  // Create a copy of layout_param with splits added where necessary.
   NetParameter param;
-  InsertSplits(filtered_param, &param);
+  InsertSplits(layout_param, &param);
   // Basically, build all the layers and set up their connections.
   name_ = param.name();
   map<string, int> blob_name_to_idx;
@@ -292,13 +304,153 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   ShareWeights();
+  if (param.flat_params()) {
+    FlattenParams();
+  }
   debug_info_ = param.debug_info();
+  reuse_activations_ = param.reuse_activations() && phase_ == TEST;
+  if (param.reuse_activations() && phase_ != TEST) {
+    LOG(WARNING) << "reuse_activations is ignored outside the TEST phase.";
+  }
+  if (reuse_activations_) {
+    PlanActivationMemory();
+  }
+  parallel_forward_ = param.parallel_forward() && phase_ == TEST;
+  if (param.parallel_forward() && phase_ != TEST) {
+    LOG(WARNING) << "parallel_forward is ignored outside the TEST phase.";
+  }
+  if (parallel_forward_) {
+    int num_threads = param.forward_threads();
+    if (num_threads <= 0) {
+      num_threads = std::max<int>(boost::thread::hardware_concurrency(), 1);
+    }
+    forward_pool_.reset(new ThreadPool(num_threads));
+    BuildForwardSchedule();
+  }
   if (Caffe::root_solver()) {
     LOG(INFO) << "Network initialization done.";
     LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::PlanActivationMemory() {
+  const int num_blobs = blobs_.size();
+  // Blobs whose memory must not be shared: the inputs and outputs of the
+  // net, whose values are read from outside, and the tops of data layers,
+  // which may point their blobs at memory of their own.
+  vector<bool> keep(num_blobs, false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    keep[net_input_blob_indices_[i]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    keep[net_output_blob_indices_[i]] = true;
+  }
+  // Each blob is live from the first layer that writes it to the last layer
+  // that reads or writes it. Tops of layers that take over the data of their
+  // bottom join its group, which is live as long as any of its members.
+  vector<int> group(num_blobs);
+  vector<int> first_use(num_blobs, layers_.size());
+  vector<int> last_use(num_blobs, -1);
+  for (int i = 0; i < num_blobs; ++i) {
+    group[i] = i;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      last_use[bottom_ids[i]] = layer_id;
+    }
+    for (int i = 0; i < top_ids.size(); ++i) {
+      const int blob_id = top_ids[i];
+      first_use[blob_id] = std::min(first_use[blob_id], layer_id);
+      last_use[blob_id] = layer_id;
+      if (bottom_ids.size() == 0) {
+        keep[blob_id] = true;
+      } else if (layers_[layer_id]->SharesBottomData() &&
+          blob_id != bottom_ids[0]) {
+        group[blob_id] = group[bottom_ids[0]];
+      }
+    }
+  }
+  vector<int> group_first(num_blobs, layers_.size());
+  vector<int> group_last(num_blobs, -1);
+  vector<size_t> group_size(num_blobs, 0);
+  vector<bool> group_keep(num_blobs, false);
+  for (int i = 0; i < num_blobs; ++i) {
+    const int g = group[i];
+    group_first[g] = std::min(group_first[g], first_use[i]);
+    group_last[g] = std::max(group_last[g], last_use[i]);
+    group_size[g] = std::max(group_size[g], blobs_[i]->count() * sizeof(Dtype));
+    group_keep[g] = group_keep[g] || keep[i];
+  }
+  vector<pair<int, int> > groups_by_first_use;
+  for (int g = 0; g < num_blobs; ++g) {
+    if (group[g] == g && !group_keep[g] && group_size[g] > 0 &&
+        group_last[g] >= group_first[g]) {
+      groups_by_first_use.push_back(make_pair(group_first[g], g));
+    }
+  }
+  std::sort(groups_by_first_use.begin(), groups_by_first_use.end());
+  // Give each group, in order of first use, the free buffer that fits it most
+  // tightly, or else the largest free buffer, grown, or else a new one.
+  vector<size_t> buffer_sizes;
+  vector<int> buffer_last_use;
+  vector<int> group_buffer(num_blobs, -1);
+  for (int i = 0; i < groups_by_first_use.size(); ++i) {
+    const int g = groups_by_first_use[i].second;
+    int best = -1;
+    for (int b = 0; b < buffer_sizes.size(); ++b) {
+      if (buffer_last_use[b] >= group_first[g]) { continue; }
+      if (best < 0) {
+        best = b;
+      } else if (buffer_sizes[best] >= group_size[g]) {
+        if (buffer_sizes[b] >= group_size[g] &&
+            buffer_sizes[b] < buffer_sizes[best]) {
+          best = b;
+        }
+      } else if (buffer_sizes[b] > buffer_sizes[best]) {
+        best = b;
+      }
+    }
+    if (best < 0) {
+      best = buffer_sizes.size();
+      buffer_sizes.push_back(0);
+      buffer_last_use.push_back(-1);
+    }
+    buffer_sizes[best] = std::max(buffer_sizes[best], group_size[g]);
+    buffer_last_use[best] = group_last[g];
+    group_buffer[g] = best;
+  }
+  activation_buffers_.resize(buffer_sizes.size());
+  for (int b = 0; b < buffer_sizes.size(); ++b) {
+    activation_buffers_[b].reset(new SyncedMemory(buffer_sizes[b]));
+  }
+  blob_activation_buffers_.assign(num_blobs, -1);
+  int num_shared = 0;
+  for (int i = 0; i < num_blobs; ++i) {
+    const int buffer_id = group_buffer[group[i]];
+    if (buffer_id < 0) { continue; }
+    blob_activation_buffers_[i] = buffer_id;
+    blobs_[i]->ShareDataMemory(activation_buffers_[buffer_id]);
+    ++num_shared;
+  }
+  size_t unshared_size = 0;
+  for (int i = 0; i < groups_by_first_use.size(); ++i) {
+    unshared_size += group_size[groups_by_first_use[i].second];
+  }
+  size_t shared_size = 0;
+  for (int b = 0; b < buffer_sizes.size(); ++b) {
+    shared_size += buffer_sizes[b];
+  }
+  if (Caffe::root_solver()) {
+    LOG(INFO) << "Reusing activation memory: " << num_shared << " blobs "
+        << "needing " << unshared_size << " bytes share "
+        << buffer_sizes.size() << " buffers of " << shared_size
+        << " bytes, saving " << unshared_size - shared_size << " bytes.";
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -522,6 +674,7 @@ void Net<Dtype>::AppendParam(const NetParameter& param, const int layer_id,
     const int learnable_param_id = learnable_params_.size();
     learnable_params_.push_back(params_[net_param_id].get());
     learnable_param_ids_.push_back(learnable_param_id);
+    learnable_param_layer_ids_.push_back(layer_id);
     has_params_lr_.push_back(param_spec->has_lr_mult());
     has_params_decay_.push_back(param_spec->has_decay_mult());
     params_lr_.push_back(param_spec->lr_mult());
@@ -594,15 +747,193 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
       InputDebugInfo(i);
     }
   }
+  if (parallel_forward_ && Caffe::mode() == Caffe::CPU) {
+    loss = ParallelForwardFromTo(start, end);
+  } else {
+    for (int i = start; i <= end; ++i) {
+      // LOG(ERROR) << "Forwarding " << layer_names_[i];
+      Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+      loss += layer_loss;
+      if (debug_info_) { ForwardDebugInfo(i); }
+    }
+  }
+  // Replan once a full pass has grown blobs past their buffers. Not after
+  // a partial pass, whose activations may still be read by the next one.
+  if (reuse_activations_ && end == layers_.size() - 1) {
+    for (int i = 0; i < blobs_.size(); ++i) {
+      const int buffer_id = blob_activation_buffers_[i];
+      if (buffer_id >= 0 && blobs_[i]->count() * sizeof(Dtype) >
+          activation_buffers_[buffer_id]->size()) {
+        PlanActivationMemory();
+        if (parallel_forward_) {
+          BuildForwardSchedule();
+        }
+        break;
+      }
+    }
+  }
+  return loss;
+}
+
+template <typename Dtype>
+void Net<Dtype>::BuildForwardSchedule() {
+  // Blobs that may hold the same memory count as one: tops of layers that
+  // take over the data of their bottom, and blobs in one activation buffer.
+  const int num_blobs = blobs_.size();
+  vector<int> memory_id(num_blobs);
+  for (int i = 0; i < num_blobs; ++i) {
+    memory_id[i] = i;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (!layers_[layer_id]->SharesBottomData()) { continue; }
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    for (int i = 0; i < top_ids.size(); ++i) {
+      memory_id[top_ids[i]] = memory_id[bottom_id_vecs_[layer_id][0]];
+    }
+  }
+  if (reuse_activations_) {
+    for (int i = 0; i < num_blobs; ++i) {
+      if (blob_activation_buffers_[i] >= 0) {
+        memory_id[i] = num_blobs + blob_activation_buffers_[i];
+      }
+    }
+  }
+  // A layer waits for the last earlier layer to write the memory it reads
+  // or writes, and for the earlier layers that read the memory it writes
+  // since then.
+  map<int, int> last_writer;
+  map<int, set<int> > readers;
+  layer_dependencies_.assign(layers_.size(), vector<int>());
+  layer_dependents_.assign(layers_.size(), vector<int>());
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    set<int> dependencies;
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      const int memory = memory_id[bottom_ids[i]];
+      if (last_writer.count(memory)) {
+        dependencies.insert(last_writer[memory]);
+      }
+      readers[memory].insert(layer_id);
+    }
+    for (int i = 0; i < top_ids.size(); ++i) {
+      const int memory = memory_id[top_ids[i]];
+      if (last_writer.count(memory)) {
+        dependencies.insert(last_writer[memory]);
+      }
+      dependencies.insert(readers[memory].begin(), readers[memory].end());
+      readers[memory].clear();
+      last_writer[memory] = layer_id;
+    }
+    dependencies.erase(layer_id);
+    for (set<int>::const_iterator it = dependencies.begin();
+        it != dependencies.end(); ++it) {
+      layer_dependencies_[layer_id].push_back(*it);
+      layer_dependents_[*it].push_back(layer_id);
+    }
+  }
+}
+
+template <typename Dtype>
+class Net<Dtype>::ForwardState {
+ public:
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+  // For each layer of the pass, the number of its dependencies not yet done.
+  vector<int> pending_;
+  vector<Dtype> losses_;
+  int remaining_;
+};
+
+template <typename Dtype>
+Dtype Net<Dtype>::ParallelForwardFromTo(int start, int end) {
+  ForwardState state;
+  state.pending_.assign(end - start + 1, 0);
+  state.losses_.assign(end - start + 1, Dtype(0));
+  state.remaining_ = end - start + 1;
+  // Layers before start count as done.
   for (int i = start; i <= end; ++i) {
-    // LOG(ERROR) << "Forwarding " << layer_names_[i];
-    Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
-    loss += layer_loss;
+    for (int j = 0; j < layer_dependencies_[i].size(); ++j) {
+      if (layer_dependencies_[i][j] >= start) {
+        ++state.pending_[i - start];
+      }
+    }
+  }
+  // Find the ready layers before queueing any: once running, they count
+  // down pending_ for the others. Layers that have to run on this thread,
+  // e.g. because they draw from its RNG, are left to it.
+  vector<int> ready;
+  vector<int> caller_layers;
+  for (int i = start; i <= end; ++i) {
+    if (layers_[i]->ForwardOnCallingThread()) {
+      caller_layers.push_back(i);
+    } else if (state.pending_[i - start] == 0) {
+      ready.push_back(i);
+    }
+  }
+  for (int i = 0; i < ready.size(); ++i) {
+    forward_pool_->Enqueue(boost::bind(&Net<Dtype>::ParallelForwardLayer,
+        this, ready[i], start, end, &state));
+  }
+  {
+    // Run the caller's layers in layer order, so that they draw the same
+    // numbers as in the serial pass. The next one only waits for earlier
+    // layers, so it always becomes ready.
+    boost::mutex::scoped_lock lock(state.mutex_);
+    int next_caller = 0;
+    while (state.remaining_ > 0) {
+      if (next_caller < caller_layers.size() &&
+          state.pending_[caller_layers[next_caller] - start] == 0) {
+        const int layer_id = caller_layers[next_caller++];
+        lock.unlock();
+        ParallelForwardLayer(layer_id, start, end, &state);
+        lock.lock();
+      } else {
+        state.condition_.wait(lock);
+      }
+    }
+  }
+  // Sum the losses and report in layer order, as the serial pass does.
+  Dtype loss = 0;
+  for (int i = start; i <= end; ++i) {
+    loss += state.losses_[i - start];
     if (debug_info_) { ForwardDebugInfo(i); }
   }
   return loss;
 }
 
+template <typename Dtype>
+void Net<Dtype>::ParallelForwardLayer(int layer_id, int start, int end,
+    ForwardState* state) {
+  const Dtype loss = layers_[layer_id]->Forward(bottom_vecs_[layer_id],
+      top_vecs_[layer_id]);
+  vector<int> ready;
+  {
+    boost::mutex::scoped_lock lock(state->mutex_);
+    state->losses_[layer_id - start] = loss;
+    const vector<int>& dependents = layer_dependents_[layer_id];
+    for (int i = 0; i < dependents.size(); ++i) {
+      const int dependent = dependents[i];
+      if (dependent <= end && --state->pending_[dependent - start] == 0) {
+        if (layers_[dependent]->ForwardOnCallingThread()) {
+          state->condition_.notify_all();
+        } else {
+          ready.push_back(dependent);
+        }
+      }
+    }
+    // Notify under the lock: once the last layer is done the caller may
+    // return and destroy state.
+    if (--state->remaining_ == 0) {
+      state->condition_.notify_all();
+    }
+  }
+  for (int i = 0; i < ready.size(); ++i) {
+    forward_pool_->Enqueue(boost::bind(&Net<Dtype>::ParallelForwardLayer,
+        this, ready[i], start, end, state));
+  }
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFrom(int start) {
   return ForwardFromTo(start, layers_.size() - 1);
@@ -658,12 +989,17 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  CHECK(!reuse_activations_)
+      << "Backward needs every activation; disable reuse_activations.";
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
       if (debug_info_) { BackwardDebugInfo(i); }
     }
+    for (int c = 0; c < callbacks_.size(); ++c) {
+      callbacks_[c]->on_backward_done(i);
+    }
   }
 }
 
@@ -1012,6 +1348,11 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
 
 template <typename Dtype>
 void Net<Dtype>::Update() {
+  if (flat_params_ && Caffe::mode() == Caffe::CPU) {
+    caffe_axpy<Dtype>(flat_params_count(), Dtype(-1),
+        flat_params_cpu_diff(), mutable_flat_params_cpu_data());
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     learnable_params_[i]->Update();
   }
@@ -1019,6 +1360,11 @@ void Net<Dtype>::Update() {
 
 template <typename Dtype>
 void Net<Dtype>::ClearParamDiffs() {
+  if (flat_params_ && Caffe::mode() == Caffe::CPU) {
+    caffe_set(flat_params_count(), static_cast<Dtype>(0),
+        mutable_flat_params_cpu_diff());
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     Blob<Dtype>* blob = learnable_params_[i];
     switch (Caffe::mode()) {
@@ -1038,6 +1384,56 @@ void Net<Dtype>::ClearParamDiffs() {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::FlattenParams() {
+  if (flat_params_) { return; }
+  flat_params_.reset(new CPUParams<Dtype>(learnable_params_));
+  flat_params_->configure(learnable_params_);
+  LOG_IF(INFO, Caffe::root_solver()) << "Learnable parameters laid out in "
+      << flat_params_->size() * sizeof(Dtype) << " contiguous bytes";
+}
+
+template <typename Dtype>
+size_t Net<Dtype>::flat_params_count() const {
+  return flat_params_ ? flat_params_->size() : 0;
+}
+
+template <typename Dtype>
+const Dtype* Net<Dtype>::flat_params_cpu_data() const {
+  if (!flat_params_) { return NULL; }
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    learnable_params_[i]->cpu_data();
+  }
+  return flat_params_->data();
+}
+
+template <typename Dtype>
+const Dtype* Net<Dtype>::flat_params_cpu_diff() const {
+  if (!flat_params_) { return NULL; }
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    learnable_params_[i]->cpu_diff();
+  }
+  return flat_params_->diff();
+}
+
+template <typename Dtype>
+Dtype* Net<Dtype>::mutable_flat_params_cpu_data() {
+  if (!flat_params_) { return NULL; }
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    learnable_params_[i]->mutable_cpu_data();
+  }
+  return flat_params_->data();
+}
+
+template <typename Dtype>
+Dtype* Net<Dtype>::mutable_flat_params_cpu_diff() {
+  if (!flat_params_) { return NULL; }
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    learnable_params_[i]->mutable_cpu_diff();
+  }
+  return flat_params_->diff();
+}
+
 template <typename Dtype>
 void Net<Dtype>::ShareWeights() {
   for (int i = 0; i < params_.size(); ++i) {
@@ -2,12 +2,22 @@
 #include <cuda_runtime.h>
 #endif
 #include <glog/logging.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <cstdlib>
+#include <set>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -59,6 +69,34 @@ static void apply_buffers(const vector<Blob<Dtype>*>& blobs,
   CHECK_EQ(total_size, (ptr == buffer ? 1 : ptr - buffer));
 }
 
+// Ranges of a params buffer holding the learnable params of each layer, which
+// lie next to each other as layers append the params they own in turn.
+template<typename Dtype>
+static void layer_ranges(const Net<Dtype>& net,
+                         vector<pair<size_t, size_t> >* ranges) {
+  const vector<Blob<Dtype>*>& params = net.learnable_params();
+  const vector<int>& layer_ids = net.learnable_param_layer_ids();
+  ranges->assign(net.layers().size(), make_pair(size_t(0), size_t(0)));
+  size_t offset = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    pair<size_t, size_t>& range = (*ranges)[layer_ids[i]];
+    if (range.first == range.second) {
+      range.first = offset;
+    } else {
+      CHECK_EQ(range.second, offset);
+    }
+    offset += params[i]->count();
+    range.second = offset;
+  }
+}
+
+// Number of layers owning learnable params
+template<typename Dtype>
+static int layers_with_params(const Net<Dtype>& net) {
+  const vector<int>& layer_ids = net.learnable_param_layer_ids();
+  return std::set<int>(layer_ids.begin(), layer_ids.end()).size();
+}
+
 // Buffer size necessary to store given blobs
 template<typename Dtype>
 static size_t total_size(const vector<Blob<Dtype>*>& params) {
@@ -77,6 +115,36 @@ Params<Dtype>::Params(shared_ptr<Solver<Dtype> > root_solver)
       diff_() {
 }
 
+template<typename Dtype>
+Params<Dtype>::Params(const vector<Blob<Dtype>*>& params)
+    : size_(total_size<Dtype>(params)),
+      data_(),
+      diff_() {
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::CPUParams(const vector<Blob<Dtype>*>& params)
+    : Params<Dtype>(params) {
+  CaffeMallocHost(reinterpret_cast<void**>(&data_), size_ * sizeof(Dtype));
+  CaffeMallocHost(reinterpret_cast<void**>(&diff_), size_ * sizeof(Dtype));
+  // Clear the padding of nets without parameters too
+  caffe_set(size_, Dtype(0), data_);
+  apply_buffers(params, data_, size_, copy);
+  caffe_set(size_, Dtype(0), diff_);
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::~CPUParams() {
+  CaffeFreeHost(data_);
+  CaffeFreeHost(diff_);
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::configure(const vector<Blob<Dtype>*>& params) const {
+  apply_buffers(params, data_, size_, replace_cpu);
+  apply_buffers(params, diff_, size_, replace_cpu_diff);
+}
+
 template<typename Dtype>
 GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
     : Params<Dtype>(root_solver) {
@@ -208,9 +276,12 @@ P2PSync<Dtype>::P2PSync(shared_ptr<Solver<Dtype> > root_solver,
     : GPUParams<Dtype>(root_solver, param.device_id()),
       parent_(parent),
       children_(),
-      queue_(),
+      // Children may each send all their layers before they are summed
+      queue_(std::max(Caffe::solver_count(), 1) *
+          std::max(layers_with_params(*root_solver->net()), 1)),
       initial_iter_(root_solver->iter()),
-      solver_() {
+      solver_(),
+      reduced_layers_() {
 #ifndef CPU_ONLY
   int initial_device;
   CUDA_CHECK(cudaGetDevice(&initial_device));
@@ -226,6 +297,16 @@ P2PSync<Dtype>::P2PSync(shared_ptr<Solver<Dtype> > root_solver,
   }
   this->configure(solver_.get());
   solver_->add_callback(this);
+  solver_->net()->add_callback(this);
+
+  layer_ranges(*solver_->net(), &layer_ranges_);
+  layer_passes_.resize(layer_ranges_.size());
+  CUDA_CHECK(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+  CUDA_CHECK(cudaEventCreateWithFlags(&reduced_, cudaEventDisableTiming));
+  sent_.resize(layer_ranges_.size());
+  for (int i = 0; i < sent_.size(); ++i) {
+    CUDA_CHECK(cudaEventCreateWithFlags(&sent_[i], cudaEventDisableTiming));
+  }
 
   if (parent) {
     // Enable p2p access between devices
@@ -257,6 +338,12 @@ P2PSync<Dtype>::~P2PSync() {
   const int self = solver_->param().device_id();
   CUDA_CHECK(cudaSetDevice(self));
 
+  for (int i = 0; i < sent_.size(); ++i) {
+    CUDA_CHECK(cudaEventDestroy(sent_[i]));
+  }
+  CUDA_CHECK(cudaEventDestroy(reduced_));
+  CUDA_CHECK(cudaStreamDestroy(stream_));
+
   if (parent_) {
     CUDA_CHECK(cudaFree(parent_grads_));
     const int peer = parent_->solver_->param().device_id();
@@ -298,6 +385,11 @@ void P2PSync<Dtype>::on_start() {
 //  CHECK(false);
 #endif
 
+  // Children only send gradients once updated below
+  std::fill(layer_passes_.begin(), layer_passes_.end(), 0);
+  reduced_layers_ = 0;
+  child_layers_.assign(children_.size(), 0);
+
   // Wait for update from parent
   if (parent_) {
     P2PSync<Dtype> *parent = queue_.pop();
@@ -325,6 +417,46 @@ void P2PSync<Dtype>::on_start() {
 #endif
 }
 
+template<typename Dtype>
+void P2PSync<Dtype>::on_backward_done(int layer_id) {
+#ifndef CPU_ONLY
+  const pair<size_t, size_t>& range = layer_ranges_[layer_id];
+  if (range.first == range.second ||
+      ++layer_passes_[layer_id] < solver_->param().iter_size()) {
+    return;
+  }
+  const size_t count = range.second - range.first;
+  Dtype* dst = diff_ + range.first;
+  ++reduced_layers_;
+
+  // Sum children gradients of this layer, once they have all sent it. The
+  // children go through the layers in the same order.
+  for (int i = 0; i < children_.size(); ++i) {
+    while (child_layers_[i] < reduced_layers_) {
+      P2PSync<Dtype> *child = queue_.pop();
+      const int j = std::find(children_.begin(), children_.end(), child)
+          - children_.begin();
+      CHECK_LT(j, children_.size());
+      ++child_layers_[j];
+    }
+    P2PSync<Dtype> *child = children_[i];
+    CUDA_CHECK(cudaStreamWaitEvent(cudaStreamDefault,
+        child->sent_[layer_id], 0));
+    caffe_gpu_add(count, child->parent_grads_ + range.first, dst, dst);
+  }
+
+  // Send gradients to parent, while backward goes on with the lower layers
+  if (parent_) {
+    CUDA_CHECK(cudaEventRecord(reduced_, cudaStreamDefault));
+    CUDA_CHECK(cudaStreamWaitEvent(stream_, reduced_, 0));
+    CUDA_CHECK(cudaMemcpyAsync(parent_grads_ + range.first, dst,
+        count * sizeof(Dtype), cudaMemcpyDeviceToDevice, stream_));
+    CUDA_CHECK(cudaEventRecord(sent_[layer_id], stream_));
+    parent_->queue_.push(this);
+  }
+#endif
+}
+
 template<typename Dtype>
 void P2PSync<Dtype>::on_gradients_ready() {
 #ifndef CPU_ONLY
@@ -334,47 +466,14 @@ void P2PSync<Dtype>::on_gradients_ready() {
   CHECK(device == solver_->param().device_id());
 #endif
 
-  // Sum children gradients as they appear in the queue
+  // Every layer went up the tree during backward
   for (int i = 0; i < children_.size(); ++i) {
-    P2PSync<Dtype> *child = queue_.pop();
-    Dtype* src = child->parent_grads_;
-    Dtype* dst = diff_;
-
-#ifdef DEBUG
-    bool ok = false;
-    for (int j = 0; j < children_.size(); ++j) {
-      if (child == children_[j]) {
-        ok = true;
-      }
-    }
-    CHECK(ok);
-    cudaPointerAttributes attributes;
-    CUDA_CHECK(cudaPointerGetAttributes(&attributes, src));
-    CHECK(attributes.device == device);
-    CUDA_CHECK(cudaPointerGetAttributes(&attributes, dst));
-    CHECK(attributes.device == device);
-#endif
-
-    caffe_gpu_add(size_, src, dst, dst);
+    CHECK_EQ(child_layers_[i], reduced_layers_);
   }
 
-  // Send gradients to parent
   if (parent_) {
-    Dtype* src = diff_;
-    Dtype* dst = parent_grads_;
-
-#ifdef DEBUG
-    cudaPointerAttributes attributes;
-    CUDA_CHECK(cudaPointerGetAttributes(&attributes, src));
-    CHECK(attributes.device == device);
-    CUDA_CHECK(cudaPointerGetAttributes(&attributes, dst));
-    CHECK(attributes.device == parent_->solver_->param().device_id());
-#endif
-
-    CUDA_CHECK(cudaMemcpyAsync(dst, src, size_ * sizeof(Dtype),  //
-        cudaMemcpyDeviceToDevice, cudaStreamDefault));
-    CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
-    parent_->queue_.push(this);
+    // Diffs are cleared next iteration, so let the last copies through
+    CUDA_CHECK(cudaStreamSynchronize(stream_));
   } else {
     // Loss functions divide gradients by the batch size, so to compensate
     // for split batch, the root solver divides by number of solvers.
@@ -434,8 +533,373 @@ void P2PSync<Dtype>::run(const vector<int>& gpus) {
   }
 }
 
+//
+
+template<typename Dtype>
+CPUSync<Dtype>::CPUSync(shared_ptr<Solver<Dtype> > root_solver,
+                        CPUSync<Dtype>* parent, int rank)
+    : parent_(parent),
+      children_(),
+      queue_(std::max(Caffe::solver_count(), 1)),
+      initial_iter_(root_solver->iter()),
+      rank_(rank),
+      pin_threads_(false),
+      size_(),
+      parent_grads_(),
+      solver_() {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU) << "CPUSync runs in CPU mode.";
+  if (parent == NULL) {
+    solver_ = root_solver;
+  } else {
+    Caffe::set_root_solver(false);
+    solver_.reset(new WorkerSolver<Dtype>(root_solver->param(),
+        root_solver.get()));
+    Caffe::set_root_solver(true);
+  }
+  solver_->net()->FlattenParams();
+  size_ = solver_->net()->flat_params_count();
+  if (parent) {
+    CHECK_EQ(size_, parent->size_);
+    CaffeMallocHost(reinterpret_cast<void**>(&parent_grads_),
+        size_ * sizeof(Dtype));
+  }
+  solver_->add_callback(this);
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::~CPUSync() {
+  if (parent_grads_) {
+    CaffeFreeHost(parent_grads_);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::SetUpThread() {
+  const int num_threads = Caffe::solver_count();
+  // Share the cores between the solvers' OpenMP regions
+#ifdef _OPENMP
+  omp_set_num_threads(std::max(omp_get_num_procs() / num_threads, 1));
+#endif
+  if (!pin_threads_) {
+    return;
+  }
+#ifdef __linux__
+  const int num_cores = std::max<int>(boost::thread::hardware_concurrency(), 1);
+  const int begin = rank_ * num_cores / num_threads;
+  const int end = std::max((rank_ + 1) * num_cores / num_threads, begin + 1);
+  cpu_set_t cores;
+  CPU_ZERO(&cores);
+  for (int core = begin; core < end; ++core) {
+    CPU_SET(core % num_cores, &cores);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) != 0) {
+    LOG(WARNING) << "Could not pin solver thread " << rank_ << " to cores "
+        << begin << "-" << end - 1;
+  }
+#else
+  LOG(WARNING) << "Pinning solver threads is only supported on Linux.";
+#endif
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::InternalThreadEntry() {
+  CHECK(Caffe::root_solver());
+  Caffe::set_root_solver(false);
+  SetUpThread();
+  // See if there is a defined seed and reset random state if so
+  if (solver_->param().random_seed() >= 0) {
+    // Modulate the seed by the rank so that the replicas differ, as P2PSync
+    // does with device IDs.
+    Caffe::set_random_seed(solver_->param().random_seed() + rank_);
+  }
+  solver_->Step(solver_->param().max_iter() - initial_iter_);
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_start() {
+  // Wait for update from parent
+  if (parent_) {
+    CPUSync<Dtype> *parent = queue_.pop();
+    CHECK(parent == parent_);
+  }
+
+  // Update children, which are waiting on their queues
+  const Dtype* data = solver_->net()->flat_params_cpu_data();
+  for (int i = children_.size() - 1; i >= 0; i--) {
+    caffe_copy(size_, data,
+        children_[i]->solver_->net()->mutable_flat_params_cpu_data());
+    children_[i]->queue_.push(this);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_gradients_ready() {
+  Dtype* diff = solver_->net()->mutable_flat_params_cpu_diff();
+
+  // Sum children gradients as they appear in the queue
+  for (int i = 0; i < children_.size(); ++i) {
+    CPUSync<Dtype> *child = queue_.pop();
+    caffe_axpy<Dtype>(size_, Dtype(1), child->parent_grads_, diff);
+  }
+
+  // Send gradients to parent. They are copied out since this solver clears
+  // its own as soon as it starts the next iteration.
+  if (parent_) {
+    caffe_copy(size_, diff, parent_grads_);
+    parent_->queue_.push(this);
+  } else {
+    // Loss functions divide gradients by the batch size, so to compensate
+    // for split batch, the root solver divides by number of solvers.
+    caffe_scal(size_, Dtype(1.0 / Caffe::solver_count()), diff);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::run(int num_threads, bool pin_threads) {
+  CHECK_EQ(Caffe::solver_count(), num_threads)
+      << "Set the solver count before creating the root solver, so that "
+      << "data readers feed every thread.";
+  pin_threads_ = pin_threads;
+
+  // Build a binary tree, solver i sending its gradients to (i - 1) / 2
+  vector<shared_ptr<CPUSync<Dtype> > > syncs(num_threads);
+  for (int i = 1; i < num_threads; ++i) {
+    CPUSync<Dtype>* parent = i <= 2 ? this : syncs[(i - 1) / 2].get();
+    syncs[i].reset(new CPUSync<Dtype>(solver_, parent, i));
+    syncs[i]->pin_threads_ = pin_threads;
+    parent->children_.push_back(syncs[i].get());
+  }
+
+  LOG(INFO)<< "Starting Optimization on " << num_threads << " threads";
+
+  for (int i = 1; i < syncs.size(); ++i) {
+    syncs[i]->StartInternalThread();
+  }
+
+  // Run root solver on current thread, restoring its settings afterwards
+#ifdef _OPENMP
+  const int omp_threads = omp_get_max_threads();
+#endif
+#ifdef __linux__
+  cpu_set_t cores;
+  CHECK_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cores), &cores), 0);
+#endif
+  SetUpThread();
+  solver_->Solve();
+#ifdef _OPENMP
+  omp_set_num_threads(omp_threads);
+#endif
+#ifdef __linux__
+  pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+#endif
+
+  for (int i = 1; i < syncs.size(); ++i) {
+    syncs[i]->StopInternalThread();
+  }
+}
+
+//
+
+// How long processes wait for the next one in the ring to listen
+static const int kConnectTimeoutMs = 5 * 60 * 1000;
+
+template<typename Dtype>
+SocketSync<Dtype>::SocketSync(shared_ptr<Solver<Dtype> > solver, int rank,
+                              const vector<string>& addresses,
+                              size_t bucket_size)
+    : solver_(solver),
+      rank_(rank),
+      addresses_(addresses),
+      buckets_(),
+      layer_buckets_(solver->net()->layers().size()),
+      bucket_passes_(),
+      // There are at most as many buckets as params
+      ready_(solver->net()->learnable_params().size()),
+      reduced_(solver->net()->learnable_params().size()),
+      next_(),
+      previous_(),
+      received_(),
+      diff_() {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU) << "SocketSync runs in CPU mode.";
+  CHECK_GE(rank, 0);
+  CHECK_LT(rank, addresses.size());
+  CHECK_GT(bucket_size, 0);
+  Net<Dtype>* net = solver_->net().get();
+  net->FlattenParams();
+
+  // Cut the flat array into buckets from its end, in the order backward
+  // completes the params. A bucket is complete with its lowest param, which
+  // belongs to the lowest layer.
+  const vector<Blob<Dtype>*>& params = net->learnable_params();
+  const vector<int>& layer_ids = net->learnable_param_layer_ids();
+  size_t end = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    end += params[i]->count();
+  }
+  size_t begin = end;
+  size_t largest = 0;
+  for (int i = params.size() - 1; i >= 0; --i) {
+    begin -= params[i]->count();
+    if (end - begin >= bucket_size || i == 0) {
+      layer_buckets_[layer_ids[i]].push_back(buckets_.size());
+      buckets_.push_back(std::make_pair(begin, end));
+      largest = std::max(largest, end - begin);
+      end = begin;
+    }
+  }
+  bucket_passes_.resize(buckets_.size());
+  received_.resize(largest / addresses.size() + 1);
+  solver_->add_callback(this);
+  net->add_callback(this);
+}
+
+template<typename Dtype>
+SocketSync<Dtype>::~SocketSync() {
+  StopInternalThread();
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::run() {
+  const int count = addresses_.size();
+  CHECK_EQ(Caffe::process_count(), count)
+      << "Set the process count and rank before creating the solver, so "
+      << "that data layers read the share of this process.";
+  CHECK_EQ(Caffe::process_rank(), rank_);
+  Net<Dtype>* net = solver_->net().get();
+  if (count > 1) {
+    shared_ptr<Socket> listener(Socket::Listen(addresses_[rank_]));
+    next_ = Socket::Connect(addresses_[(rank_ + 1) % count],
+        kConnectTimeoutMs);
+    previous_ = listener->Accept();
+    LOG(INFO) << "Process " << rank_ << " of " << count << " connected";
+
+    // Check the ring is wired as expected, between replicas of the same net
+    const uint64_t header[2] = {static_cast<uint64_t>(rank_),
+                                net->flat_params_count()};
+    uint64_t previous_header[2];
+    Socket::SendReceive(next_.get(), header, sizeof(header),
+        previous_.get(), previous_header, sizeof(previous_header));
+    const uint64_t previous_rank = (rank_ + count - 1) % count;
+    CHECK_EQ(previous_header[0], previous_rank)
+        << "Processes are not connected in rank order";
+    CHECK_EQ(previous_header[1], header[1])
+        << "Processes train nets with different parameters";
+
+    // Start from the weights of rank 0, passed around the ring. From then
+    // on, every process applies the same updates to them.
+    const size_t bytes = net->flat_params_count() * sizeof(Dtype);
+    Dtype* data = net->mutable_flat_params_cpu_data();
+    if (rank_ > 0) {
+      previous_->Receive(data, bytes);
+    }
+    if (rank_ < count - 1) {
+      next_->Send(data, bytes);
+    }
+  }
+
+  LOG(INFO) << "Starting Optimization on process " << rank_;
+  StartInternalThread();
+  solver_->Solve();
+  StopInternalThread();
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::on_start() {
+  // Taken here, as touching the params is not safe during backward
+  diff_ = solver_->net()->mutable_flat_params_cpu_diff();
+  std::fill(bucket_passes_.begin(), bucket_passes_.end(), 0);
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::on_backward_done(int layer_id) {
+  // With iter_size, diffs are only final in the last backward pass
+  const vector<int>& buckets = layer_buckets_[layer_id];
+  for (int i = 0; i < buckets.size(); ++i) {
+    if (++bucket_passes_[buckets[i]] == solver_->param().iter_size()) {
+      ready_.push(buckets[i]);
+    }
+  }
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::on_gradients_ready() {
+  // Reduce the buckets backward did not reach, if any, then wait for all
+  for (int i = 0; i < buckets_.size(); ++i) {
+    if (bucket_passes_[i] < solver_->param().iter_size()) {
+      bucket_passes_[i] = solver_->param().iter_size();
+      ready_.push(i);
+    }
+  }
+  for (int i = 0; i < buckets_.size(); ++i) {
+    reduced_.pop();
+  }
+  // Loss functions divide gradients by the batch size, so to compensate
+  // for split batch, divide by number of processes.
+  caffe_scal(solver_->net()->flat_params_count(),
+      Dtype(1.0 / addresses_.size()), diff_);
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      const int bucket = ready_.pop();
+      AllReduce(bucket);
+      reduced_.push(bucket);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+// Bounds of the segment-th of count segments of a bucket
+static void Segment(size_t size, int count, int segment,
+    size_t* begin, size_t* end) {
+  *begin = segment * size / count;
+  *end = (segment + 1) * size / count;
+}
+
+template<typename Dtype>
+void SocketSync<Dtype>::AllReduce(int bucket) {
+  const int count = addresses_.size();
+  if (count == 1) {
+    return;
+  }
+  const size_t size = buckets_[bucket].second - buckets_[bucket].first;
+  Dtype* diff = diff_ + buckets_[bucket].first;
+  size_t send_begin, send_end, receive_begin, receive_end;
+  // Each segment goes around the ring, every process adding its own, until
+  // it is complete on the process before the one it started from...
+  for (int step = 0; step < count - 1; ++step) {
+    Segment(size, count, (rank_ - step + count) % count,
+        &send_begin, &send_end);
+    Segment(size, count, (rank_ - step - 1 + count) % count,
+        &receive_begin, &receive_end);
+    Socket::SendReceive(next_.get(), diff + send_begin,
+        (send_end - send_begin) * sizeof(Dtype),
+        previous_.get(), &received_[0],
+        (receive_end - receive_begin) * sizeof(Dtype));
+    caffe_axpy<Dtype>(receive_end - receive_begin, Dtype(1), &received_[0],
+        diff + receive_begin);
+  }
+  // ...then goes around once more, replacing the partial sums
+  for (int step = 0; step < count - 1; ++step) {
+    Segment(size, count, (rank_ - step + 1 + count) % count,
+        &send_begin, &send_end);
+    Segment(size, count, (rank_ - step + count) % count,
+        &receive_begin, &receive_end);
+    Socket::SendReceive(next_.get(), diff + send_begin,
+        (send_end - send_begin) * sizeof(Dtype),
+        previous_.get(), diff + receive_begin,
+        (receive_end - receive_begin) * sizeof(Dtype));
+  }
+}
+
 INSTANTIATE_CLASS(Params);
+INSTANTIATE_CLASS(CPUParams);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(P2PSync);
+INSTANTIATE_CLASS(CPUSync);
+INSTANTIATE_CLASS(SocketSync);
 
 }  // namespace caffe
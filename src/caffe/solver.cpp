@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <string>
+#include <typeinfo>
 #include <vector>
 
 #include "hdf5.h"
@@ -547,9 +548,18 @@ void SGDSolver<Dtype>::ClipGradients() {
   const Dtype clip_gradients = this->param_.clip_gradients();
   if (clip_gradients < 0) { return; }
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  // A flat net clips its whole gradient array at once.
+  const bool flat = this->net_->has_flat_params() &&
+      Caffe::mode() == Caffe::CPU;
   Dtype sumsq_diff = 0;
-  for (int i = 0; i < net_params.size(); ++i) {
-    sumsq_diff += net_params[i]->sumsq_diff();
+  if (flat) {
+    const Dtype* diff = this->net_->flat_params_cpu_diff();
+    sumsq_diff = caffe_cpu_dot<Dtype>(this->net_->flat_params_count(), diff,
+        diff);
+  } else {
+    for (int i = 0; i < net_params.size(); ++i) {
+      sumsq_diff += net_params[i]->sumsq_diff();
+    }
   }
   const Dtype l2norm_diff = std::sqrt(sumsq_diff);
   if (l2norm_diff > clip_gradients) {
@@ -557,8 +567,13 @@ void SGDSolver<Dtype>::ClipGradients() {
     LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
         << l2norm_diff << " > " << clip_gradients << ") "
         << "by scale factor " << scale_factor;
-    for (int i = 0; i < net_params.size(); ++i) {
-      net_params[i]->scale_diff(scale_factor);
+    if (flat) {
+      caffe_scal<Dtype>(this->net_->flat_params_count(), scale_factor,
+          this->net_->mutable_flat_params_cpu_diff());
+    } else {
+      for (int i = 0; i < net_params.size(); ++i) {
+        net_params[i]->scale_diff(scale_factor);
+      }
     }
   }
 }
@@ -571,6 +586,11 @@ void SGDSolver<Dtype>::ApplyUpdate() {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
   ClipGradients();
+  if (Caffe::mode() == Caffe::CPU && this->param_.fused_update() &&
+      HasFusedUpdate()) {
+    ApplyFusedUpdate(rate);
+    return;
+  }
   for (int param_id = 0; param_id < this->net_->learnable_params().size();
        ++param_id) {
     Normalize(param_id);
@@ -580,6 +600,85 @@ void SGDSolver<Dtype>::ApplyUpdate() {
   this->net_->Update();
 }
 
+template <typename Dtype>
+bool SGDSolver<Dtype>::HasFusedUpdate() const {
+  const std::type_info& type = typeid(*this);
+  return type == typeid(SGDSolver<Dtype>) ||
+      type == typeid(NesterovSolver<Dtype>) ||
+      type == typeid(AdaGradSolver<Dtype>) ||
+      type == typeid(RMSPropSolver<Dtype>) ||
+      type == typeid(AdaDeltaSolver<Dtype>) ||
+      type == typeid(AdamSolver<Dtype>);
+}
+
+// Parameters are updated in chunks of this many elements, so that a few
+// large parameters still spread over the threads.
+static const int kFusedChunkSize = 1 << 16;
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ApplyFusedUpdate(Dtype rate) {
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  fused_data_.resize(net_params.size());
+  fused_diff_.resize(net_params.size());
+  vector<int> chunk_params;
+  vector<int> chunk_begins;
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    fused_data_[param_id] = net_params[param_id]->mutable_cpu_data();
+    fused_diff_[param_id] = net_params[param_id]->mutable_cpu_diff();
+    for (int begin = 0; begin < net_params[param_id]->count();
+         begin += kFusedChunkSize) {
+      chunk_params.push_back(param_id);
+      chunk_begins.push_back(begin);
+    }
+  }
+  fused_history_.resize(history_.size());
+  for (int i = 0; i < history_.size(); ++i) {
+    fused_history_[i] = history_[i]->mutable_cpu_data();
+  }
+  const int num_chunks = chunk_params.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int c = 0; c < num_chunks; ++c) {
+    const int param_id = chunk_params[c];
+    const int end = std::min(chunk_begins[c] + kFusedChunkSize,
+        net_params[param_id]->count());
+    FusedUpdate(param_id, rate, chunk_begins[c], end);
+  }
+}
+
+// Normalize and Regularize of one parameter, applied to its elements one at a
+// time by the fused updates.
+template <typename Dtype>
+class FusedGradient {
+ public:
+  FusedGradient(const SolverParameter& param, float decay_mult)
+      : normalization_(Dtype(1.) / param.iter_size()),
+        l2_decay_(0), l1_decay_(0) {
+    const Dtype local_decay = param.weight_decay() * decay_mult;
+    if (local_decay) {
+      if (param.regularization_type() == "L2") {
+        l2_decay_ = local_decay;
+      } else if (param.regularization_type() == "L1") {
+        l1_decay_ = local_decay;
+      } else {
+        LOG(FATAL) << "Unknown regularization type: "
+            << param.regularization_type();
+      }
+    }
+  }
+
+  inline Dtype operator()(Dtype diff, Dtype data) const {
+    return normalization_ * diff + l2_decay_ * data +
+        l1_decay_ * caffe_sign(data);
+  }
+
+ private:
+  const Dtype normalization_;
+  Dtype l2_decay_;
+  Dtype l1_decay_;
+};
+
 template <typename Dtype>
 void SGDSolver<Dtype>::Normalize(int param_id) {
   if (this->param_.iter_size() == 1) { return; }
@@ -703,6 +802,25 @@ void SGDSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void SGDSolver<Dtype>::FusedUpdate(int param_id, Dtype rate, int begin,
+    int end) {
+  const FusedGradient<Dtype> gradient(this->param_,
+      this->net_->params_weight_decay()[param_id]);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype momentum = this->param_.momentum();
+  Dtype* data = fused_data_[param_id];
+  Dtype* diff = fused_diff_[param_id];
+  Dtype* history = fused_history_[param_id];
+  for (int i = begin; i < end; ++i) {
+    const Dtype update =
+        local_rate * gradient(diff[i], data[i]) + momentum * history[i];
+    history[i] = update;
+    diff[i] = update;
+    data[i] -= update;
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
   switch (this->param_.snapshot_format()) {
@@ -868,6 +986,28 @@ void NesterovSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void NesterovSolver<Dtype>::FusedUpdate(int param_id, Dtype rate, int begin,
+    int end) {
+  const FusedGradient<Dtype> gradient(this->param_,
+      this->net_->params_weight_decay()[param_id]);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype momentum = this->param_.momentum();
+  Dtype* data = this->fused_data_[param_id];
+  Dtype* diff = this->fused_diff_[param_id];
+  Dtype* history = this->fused_history_[param_id];
+  for (int i = begin; i < end; ++i) {
+    const Dtype previous = history[i];
+    const Dtype current =
+        local_rate * gradient(diff[i], data[i]) + momentum * previous;
+    // step back then over step
+    const Dtype update = (Dtype(1) + momentum) * current - momentum * previous;
+    history[i] = current;
+    diff[i] = update;
+    data[i] -= update;
+  }
+}
+
 template <typename Dtype>
 void AdaGradSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   CHECK(Caffe::root_solver());
@@ -947,6 +1087,26 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaGradSolver<Dtype>::FusedUpdate(int param_id, Dtype rate, int begin,
+    int end) {
+  const FusedGradient<Dtype> gradient(this->param_,
+      this->net_->params_weight_decay()[param_id]);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype delta = this->param_.delta();
+  Dtype* data = this->fused_data_[param_id];
+  Dtype* diff = this->fused_diff_[param_id];
+  Dtype* history = this->fused_history_[param_id];
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = gradient(diff[i], data[i]);
+    const Dtype h = history[i] + g * g;
+    const Dtype update = local_rate * g / (std::sqrt(h) + delta);
+    history[i] = h;
+    diff[i] = update;
+    data[i] -= update;
+  }
+}
+
 template <typename Dtype>
 void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
@@ -1022,6 +1182,27 @@ void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void RMSPropSolver<Dtype>::FusedUpdate(int param_id, Dtype rate, int begin,
+    int end) {
+  const FusedGradient<Dtype> gradient(this->param_,
+      this->net_->params_weight_decay()[param_id]);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype delta = this->param_.delta();
+  const Dtype rms_decay = this->param_.rms_decay();
+  Dtype* data = this->fused_data_[param_id];
+  Dtype* diff = this->fused_diff_[param_id];
+  Dtype* history = this->fused_history_[param_id];
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = gradient(diff[i], data[i]);
+    const Dtype h = Dtype(1 - rms_decay) * g * g + rms_decay * history[i];
+    const Dtype update = local_rate * g / (std::sqrt(h) + delta);
+    history[i] = h;
+    diff[i] = update;
+    data[i] -= update;
+  }
+}
+
 template <typename Dtype>
 void AdaDeltaSolver<Dtype>::AdaDeltaPreSolve() {
   // Add the extra history entries for AdaDelta after those from
@@ -1168,6 +1349,35 @@ void AdaDeltaSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaDeltaSolver<Dtype>::FusedUpdate(int param_id, Dtype rate, int begin,
+    int end) {
+  const FusedGradient<Dtype> gradient(this->param_,
+      this->net_->params_weight_decay()[param_id]);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype delta = this->param_.delta();
+  const Dtype momentum = this->param_.momentum();
+  size_t update_history_offset = this->net_->learnable_params().size();
+  Dtype* data = this->fused_data_[param_id];
+  Dtype* diff = this->fused_diff_[param_id];
+  Dtype* gradient_history = this->fused_history_[param_id];
+  Dtype* update_history =
+      this->fused_history_[update_history_offset + param_id];
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = gradient(diff[i], data[i]);
+    const Dtype h = (Dtype(1) - momentum) * g * g +
+        momentum * gradient_history[i];
+    // RMS of the update history over RMS of the gradient history
+    const Dtype step = g * std::sqrt((update_history[i] + delta) / (h + delta));
+    gradient_history[i] = h;
+    update_history[i] = (Dtype(1) - momentum) * step * step +
+        momentum * update_history[i];
+    const Dtype update = local_rate * step;
+    diff[i] = update;
+    data[i] -= update;
+  }
+}
+
 template <typename Dtype>
 void AdamSolver<Dtype>::AdamPreSolve() {
   // Add the extra history entries for Adam after those from
@@ -1271,6 +1481,35 @@ void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdamSolver<Dtype>::FusedUpdate(int param_id, Dtype rate, int begin,
+    int end) {
+  const FusedGradient<Dtype> gradient(this->param_,
+      this->net_->params_weight_decay()[param_id]);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype beta1 = this->param_.momentum();
+  const Dtype beta2 = this->param_.momentum2();
+  const int t = this->iter_  + 1;
+  const Dtype correction = std::sqrt(Dtype(1) - pow(beta2, t)) /
+      (Dtype(1.) - pow(beta1, t));
+  const Dtype eps_hat = this->param_.delta();
+  size_t update_history_offset = this->net_->learnable_params().size();
+  Dtype* data = this->fused_data_[param_id];
+  Dtype* diff = this->fused_diff_[param_id];
+  Dtype* val_m = this->fused_history_[param_id];
+  Dtype* val_v = this->fused_history_[param_id + update_history_offset];
+  for (int i = begin; i < end; ++i) {
+    const Dtype g = gradient(diff[i], data[i]);
+    const Dtype m = (Dtype(1) - beta1) * g + beta1 * val_m[i];
+    const Dtype v = (Dtype(1) - beta2) * g * g + beta2 * val_v[i];
+    const Dtype update = local_rate * correction * m / (std::sqrt(v) + eps_hat);
+    val_m[i] = m;
+    val_v[i] = v;
+    diff[i] = update;
+    data[i] -= update;
+  }
+}
+
 INSTANTIATE_CLASS(Solver);
 INSTANTIATE_CLASS(SGDSolver);
 INSTANTIATE_CLASS(NesterovSolver);
@@ -52,6 +52,22 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestSwap) {
+  this->blob_->Reshape(1, 2, 3, 4);
+  const TypeParam* data = this->blob_->cpu_data();
+  const TypeParam* preshaped_data = this->blob_preshaped_->cpu_data();
+  this->blob_->Swap(this->blob_preshaped_);
+  EXPECT_EQ(this->blob_->count(), 120);
+  EXPECT_EQ(this->blob_->num(), 2);
+  EXPECT_EQ(this->blob_->cpu_data(), preshaped_data);
+  EXPECT_EQ(this->blob_preshaped_->count(), 24);
+  EXPECT_EQ(this->blob_preshaped_->num(), 1);
+  EXPECT_EQ(this->blob_preshaped_->cpu_data(), data);
+  // Reshaping within the swapped capacity keeps the memory.
+  this->blob_->Reshape(1, 3, 4, 5);
+  EXPECT_EQ(this->blob_->cpu_data(), preshaped_data);
+}
+
 TYPED_TEST(BlobSimpleTest, TestLegacyBlobProtoShapeEquals) {
   BlobProto blob_proto;
 
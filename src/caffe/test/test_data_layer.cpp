@@ -1,3 +1,4 @@
+#include <set>
 #include <string>
 #include <vector>
 
@@ -8,6 +9,7 @@
 #include "caffe/common.hpp"
 #include "caffe/data_layers.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
@@ -104,6 +106,77 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Reads with a batch size that does not divide the number of records, so
+  // batches span the end of the database, and checks the records come in
+  // database order. With several processes, the reader acts as the given one
+  // and only gets its turns of the records.
+  void TestReadSharded(const int reader_threads, const int process_count = 1,
+      const int process_rank = 0) {
+    const int batch_size = 3;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_reader_threads(reader_threads);
+
+    Caffe::set_process_count(process_count);
+    Caffe::set_process_rank(process_rank);
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    Caffe::set_process_count(1);
+    Caffe::set_process_rank(0);
+    for (int iter = 0; iter < 20; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        const int label =
+            ((iter * batch_size + i) * process_count + process_rank) % 5;
+        EXPECT_EQ(label, blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
+  // Reads through two prefetched batches swapped with the top blobs, and
+  // checks the top blobs take turns in the memory of the batches and their
+  // own, in CPU mode, without mixing up the records.
+  void TestReadSwapped() {
+    const int batch_size = 3;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_prefetch(2);
+    data_param->set_swap_prefetched(true);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    std::set<const Dtype*> buffers;
+    for (int iter = 0; iter < 20; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      buffers.insert(blob_top_data_->cpu_data());
+      for (int i = 0; i < batch_size; ++i) {
+        const int label = (iter * batch_size + i) % 5;
+        EXPECT_EQ(label, blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+    if (Caffe::mode() == Caffe::CPU) {
+      EXPECT_EQ(3, buffers.size());
+    } else {
+      EXPECT_EQ(1, buffers.size());
+    }
+  }
+
   void TestReshape(DataParameter_DB backend) {
     const int num_inputs = 5;
     // Save data of varying shapes.
@@ -278,6 +351,94 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Returns the data of a few batches cropped and mirrored at random with
+  // the Caffe seed, transformed on transform_threads threads.
+  vector<Dtype> ReadCropTrainSeeded(const int transform_threads) {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_transform_threads(transform_threads);
+
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_crop_size(2);
+    transform_param->set_mirror(true);
+
+    Caffe::set_random_seed(seed_);
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    vector<Dtype> data;
+    for (int iter = 0; iter < 4; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, blob_top_label_->cpu_data()[i]);
+      }
+      data.insert(data.end(), blob_top_data_->cpu_data(),
+          blob_top_data_->cpu_data() + blob_top_data_->count());
+    }
+    return data;
+  }
+
+  // Checks the random crops and mirrors do not depend on the number of
+  // transform threads.
+  void TestReadCropTrainThreads() {
+    const vector<Dtype> expected = ReadCropTrainSeeded(1);
+    for (int transform_threads = 2; transform_threads <= 6;
+         transform_threads += 4) {
+      const vector<Dtype> data = ReadCropTrainSeeded(transform_threads);
+      ASSERT_EQ(expected.size(), data.size());
+      for (int i = 0; i < data.size(); ++i) {
+        EXPECT_EQ(expected[i], data[i]) << "debug: threads "
+            << transform_threads << " index " << i;
+      }
+    }
+  }
+
+  // Returns the initial weights of a net that reads the DB on
+  // transform_threads threads, set up with the Caffe seed.
+  vector<Dtype> InitNetWeights(const int transform_threads) {
+    NetParameter param;
+    LayerParameter* data_layer_param = param.add_layer();
+    data_layer_param->set_name("data");
+    data_layer_param->set_type("Data");
+    data_layer_param->add_top("data");
+    data_layer_param->add_top("label");
+    DataParameter* data_param = data_layer_param->mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_transform_threads(transform_threads);
+    LayerParameter* ip_layer_param = param.add_layer();
+    ip_layer_param->set_name("ip");
+    ip_layer_param->set_type("InnerProduct");
+    ip_layer_param->add_bottom("data");
+    ip_layer_param->add_top("ip");
+    InnerProductParameter* ip_param =
+        ip_layer_param->mutable_inner_product_param();
+    ip_param->set_num_output(3);
+    ip_param->mutable_weight_filler()->set_type("gaussian");
+
+    Caffe::set_random_seed(seed_);
+    Net<Dtype> net(param);
+    const Blob<Dtype>& weights = *net.params()[0];
+    return vector<Dtype>(weights.cpu_data(),
+        weights.cpu_data() + weights.count());
+  }
+
+  // Checks setting up the transform threads does not change the weights
+  // the fillers of the net draw after the data layer.
+  void TestNetInitThreads() {
+    const vector<Dtype> expected = InitNetWeights(1);
+    const vector<Dtype> weights = InitNetWeights(4);
+    ASSERT_EQ(expected.size(), weights.size());
+    for (int i = 0; i < weights.size(); ++i) {
+      EXPECT_EQ(expected[i], weights[i]) << "debug: index " << i;
+    }
+  }
+
   void TestReadCropTrainSequenceUnseeded() {
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -354,6 +515,25 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShardedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadSharded(3);
+}
+
+TYPED_TEST(DataLayerTest, TestReadProcessShardedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadSharded(1, 2, 1);
+  this->TestReadSharded(3, 3, 2);
+}
+
+TYPED_TEST(DataLayerTest, TestReadSwappedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadSwapped();
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
@@ -372,6 +552,20 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLevelDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that the random crops do not depend on the number of threads.
+TYPED_TEST(DataLayerTest, TestReadCropTrainThreadsLevelDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadCropTrainThreads();
+}
+
+// Test that the number of threads does not change the initial weights.
+TYPED_TEST(DataLayerTest, TestNetInitThreadsLevelDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestNetInitThreads();
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
@@ -392,6 +586,25 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShardedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadSharded(3);
+}
+
+TYPED_TEST(DataLayerTest, TestReadProcessShardedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadSharded(1, 2, 1);
+  this->TestReadSharded(3, 3, 2);
+}
+
+TYPED_TEST(DataLayerTest, TestReadSwappedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadSwapped();
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -410,6 +623,20 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that the random crops do not depend on the number of threads.
+TYPED_TEST(DataLayerTest, TestReadCropTrainThreadsLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadCropTrainThreads();
+}
+
+// Test that the number of threads does not change the initial weights.
+TYPED_TEST(DataLayerTest, TestNetInitThreadsLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestNetInitThreads();
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
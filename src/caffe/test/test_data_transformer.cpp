@@ -1,3 +1,5 @@
+#include <opencv2/core/core.hpp>
+
 #include <string>
 #include <vector>
 
@@ -352,4 +354,187 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestPixelsOutsideDatum) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int label = 0;
+  const int channels = 3;
+  const int height = 4;
+  const int width = 5;
+  const int crop_size = 2;
+
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  transform_param.add_mean_value(1);
+  Datum datum;
+  FillDatum(label, channels, height, width, unique_pixels, &datum);
+  const string pixels = datum.data();
+  Blob<TypeParam> blob(1, channels, crop_size, crop_size);
+  Blob<TypeParam> blob_outside(1, channels, crop_size, crop_size);
+  DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+  // Same seed for both, so that they crop and mirror the same way.
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    Caffe::set_random_seed(this->seed_ + iter);
+    transformer.InitRand();
+    transformer.Transform(datum, &blob);
+    datum.clear_data();
+    Caffe::set_random_seed(this->seed_ + iter);
+    transformer.InitRand();
+    transformer.Transform(datum, pixels.data(), &blob_outside);
+    datum.set_data(pixels);
+    for (int j = 0; j < blob.count(); ++j) {
+      EXPECT_EQ(blob.cpu_data()[j], blob_outside.cpu_data()[j]);
+    }
+  }
+}
+
+// The per-pixel transformation of an image of channels x height x width
+// values, at (c, h, w) in pixel(c, h, w), cropped at h_off, w_off to out's
+// shape, which the vectorized loops of DataTransformer must reproduce.
+template <typename Dtype, typename PixelFn>
+static void ReferenceTransform(const TransformationParameter& param,
+    const Blob<Dtype>& mean_blob, const PixelFn& pixel, const int channels,
+    const int height, const int width, const int h_off, const int w_off,
+    const bool do_mirror, Blob<Dtype>* out) {
+  const int out_height = out->height();
+  const int out_width = out->width();
+  Dtype* out_data = out->mutable_cpu_data();
+  for (int c = 0; c < channels; ++c) {
+    for (int h = 0; h < out_height; ++h) {
+      for (int w = 0; w < out_width; ++w) {
+        const int data_index = (c * height + h_off + h) * width + w_off + w;
+        const int top_index = (c * out_height + h) * out_width +
+            (do_mirror ? out_width - 1 - w : w);
+        const Dtype element = pixel(c, h_off + h, w_off + w);
+        if (param.has_mean_file()) {
+          out_data[top_index] =
+              (element - mean_blob.cpu_data()[data_index]) * param.scale();
+        } else if (param.mean_value_size() > 0) {
+          out_data[top_index] = (element - static_cast<Dtype>(
+              param.mean_value(param.mean_value_size() == 1 ? 0 : c)))
+              * param.scale();
+        } else {
+          out_data[top_index] = element * param.scale();
+        }
+      }
+    }
+  }
+}
+
+struct DatumPixel {
+  DatumPixel(const Datum& datum, bool use_float)
+      : datum_(datum), use_float_(use_float) {}
+  float operator()(int c, int h, int w) const {
+    const int index = (c * datum_.height() + h) * datum_.width() + w;
+    return use_float_ ? datum_.float_data(index) :
+        static_cast<uint8_t>(datum_.data()[index]);
+  }
+  const Datum& datum_;
+  const bool use_float_;
+};
+
+struct MatPixel {
+  explicit MatPixel(const cv::Mat& mat) : mat_(mat) {}
+  float operator()(int c, int h, int w) const {
+    return mat_.ptr<uchar>(h)[w * mat_.channels() + c];
+  }
+  const cv::Mat& mat_;
+};
+
+// Checks the transformation matches the reference exactly, mirrored or not,
+// for each source and kind of mean, with and without cropping.
+TYPED_TEST(DataTransformTest, TestParity) {
+  typedef TypeParam Dtype;
+  const int channels = 3;
+  const int height = 5;
+  const int width = 13;
+  const int size = channels * height * width;
+  Datum datum;
+  FillDatum(0, channels, height, width, true, &datum);
+  for (int i = 0; i < size; ++i) {
+    datum.add_float_data(i * 0.37 - 10);
+  }
+  cv::Mat mat(height, width, CV_8UC3);
+  for (int h = 0; h < height; ++h) {
+    for (int i = 0; i < width * channels; ++i) {
+      mat.ptr<uchar>(h)[i] = (h * width * channels + i * 7) % 256;
+    }
+  }
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  BlobProto mean_proto;
+  mean_proto.set_num(1);
+  mean_proto.set_channels(channels);
+  mean_proto.set_height(height);
+  mean_proto.set_width(width);
+  for (int i = 0; i < size; ++i) {
+    mean_proto.add_data(i * 1.5 - 30);
+  }
+  WriteProtoToBinaryFile(mean_proto, mean_file);
+  Blob<Dtype> mean_blob;
+  mean_blob.FromProto(mean_proto);
+
+  for (int source = 0; source < 3; ++source) {
+    for (int mean = 0; mean < 4; ++mean) {
+      for (int crop_size = 0; crop_size <= 3; crop_size += 3) {
+        TransformationParameter param;
+        param.set_scale(0.25);
+        param.set_mirror(true);
+        param.set_crop_size(crop_size);
+        if (mean == 1) {
+          param.set_mean_file(mean_file);
+        } else if (mean == 2) {
+          param.add_mean_value(100);
+        } else if (mean == 3) {
+          param.add_mean_value(10);
+          param.add_mean_value(120.5);
+          param.add_mean_value(-3);
+        }
+        const int out_height = crop_size ? crop_size : height;
+        const int out_width = crop_size ? crop_size : width;
+        const int h_off = (height - out_height) / 2;
+        const int w_off = (width - out_width) / 2;
+        Blob<Dtype> expected[2];
+        for (int do_mirror = 0; do_mirror < 2; ++do_mirror) {
+          expected[do_mirror].Reshape(1, channels, out_height, out_width);
+          if (source < 2) {
+            ReferenceTransform(param, mean_blob,
+                DatumPixel(datum, source == 1), channels, height, width,
+                h_off, w_off, do_mirror, &expected[do_mirror]);
+          } else {
+            ReferenceTransform(param, mean_blob, MatPixel(mat), channels,
+                height, width, h_off, w_off, do_mirror, &expected[do_mirror]);
+          }
+        }
+        DataTransformer<Dtype> transformer(param, TEST);
+        Caffe::set_random_seed(this->seed_);
+        transformer.InitRand();
+        Blob<Dtype> blob(1, channels, out_height, out_width);
+        int num_mirrored = 0;
+        for (int iter = 0; iter < this->num_iter_ * 2; ++iter) {
+          if (source == 0) {
+            transformer.Transform(datum, &blob);
+          } else if (source == 1) {
+            Datum float_datum(datum);
+            float_datum.clear_data();
+            transformer.Transform(float_datum, &blob);
+          } else {
+            transformer.Transform(mat, &blob);
+          }
+          const bool mirrored =
+              blob.cpu_data()[0] != expected[0].cpu_data()[0];
+          num_mirrored += mirrored;
+          for (int j = 0; j < blob.count(); ++j) {
+            EXPECT_EQ(expected[mirrored].cpu_data()[j], blob.cpu_data()[j])
+                << "source " << source << " mean " << mean << " crop "
+                << crop_size << " index " << j;
+          }
+        }
+        EXPECT_GT(num_mirrored, 0);
+        EXPECT_LT(num_mirrored, this->num_iter_ * 2);
+      }
+    }
+  }
+}
+
 }  // namespace caffe
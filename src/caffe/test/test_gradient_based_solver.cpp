@@ -1,3 +1,7 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <unistd.h>
+
 #include <algorithm>
 #include <string>
 #include <utility>
@@ -19,6 +23,14 @@ using std::ostringstream;
 
 namespace caffe {
 
+template <typename Dtype>
+static void RunSocketSync(SocketSync<Dtype>* sync, int count, int rank) {
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_process_count(count);
+  Caffe::set_process_rank(rank);
+  sync->run();
+}
+
 template <typename TypeParam>
 class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -26,7 +38,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), fused_update_(true), regularization_type_("L2"),
+      distributed_(false), tcp_(false) {
         input_file_ = new string(
         CMAKE_SOURCE_DIR "caffe/test/test_data/solver_data_list.txt" CMAKE_EXT);
       }
@@ -37,11 +50,20 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   string snapshot_prefix_;
   shared_ptr<SGDSolver<Dtype> > solver_;
   shared_ptr<P2PSync<Dtype> > sync_;
+  shared_ptr<CPUSync<Dtype> > cpu_sync_;
   int seed_;
   // Dimensions are determined by generate_sample_data.py
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  bool fused_update_;
+  string regularization_type_;
+  // Whether CPU runs on several devices use processes, or rather threads
+  // standing for them, instead of CPUSync solver threads
+  bool distributed_;
+  // Whether the processes connect over TCP on the loopback interface,
+  // rather than over Unix domain sockets
+  bool tcp_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -173,7 +195,9 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
        "} ";
     if (weight_decay != 0) {
       proto << "weight_decay: " << weight_decay << " ";
+      proto << "regularization_type: '" << regularization_type_ << "' ";
     }
+    proto << "fused_update: " << fused_update_ << " ";
     if (momentum != 0) {
       proto << "momentum: " << momentum << " ";
     }
@@ -193,6 +217,52 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+    } else if (Caffe::mode() == Caffe::CPU && distributed_) {
+      LOG(INFO) << "Distributed CPU test on " << devices << " processes";
+      vector<string> addresses;
+      for (int i = 0; i < devices; ++i) {
+        ostringstream address;
+        if (tcp_) {
+          // Ports apart for each test process, in the dynamic range
+          address << "127.0.0.1:" << 49152 + getpid() % 4096 * 4 + i;
+        } else {
+          address << "unix:" << snapshot_prefix_ << "/rank" << i;
+        }
+        addresses.push_back(address.str());
+      }
+      // Each process has a solver of its own, initialized differently until
+      // the ring starts them all from the weights of the first one, and
+      // reading its own batches. Buckets of one value split the params, and
+      // leave some processes without any of the bias.
+      const size_t kBucketSize = 1;
+      shared_ptr<SGDSolver<Dtype> > root_solver = this->solver_;
+      vector<shared_ptr<SocketSync<Dtype> > > syncs;
+      Caffe::set_process_count(devices);
+      for (int i = 0; i < devices; ++i) {
+        if (i > 0) {
+          Caffe::set_process_rank(i);
+          Caffe::set_random_seed(this->seed_ + i);
+          this->InitSolverFromProtoString(proto.str());
+        }
+        syncs.push_back(shared_ptr<SocketSync<Dtype> >(new SocketSync<Dtype>(
+            this->solver_, i, addresses, kBucketSize)));
+      }
+      this->solver_ = root_solver;
+      boost::thread_group threads;
+      for (int i = 1; i < devices; ++i) {
+        threads.create_thread(boost::bind(&RunSocketSync<Dtype>,
+            syncs[i].get(), devices, i));
+      }
+      Caffe::set_process_rank(0);
+      syncs[0]->run();
+      threads.join_all();
+      Caffe::set_process_count(1);
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO) << "Multi-thread CPU test on " << devices << " threads";
+      Caffe::set_solver_count(devices);
+      this->cpu_sync_.reset(new CPUSync<Dtype>(this->solver_, NULL, 0));
+      this->cpu_sync_->run(devices);
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO) << "Multi-GPU test on " << devices << " devices";
       vector<int> gpus;
@@ -449,6 +519,49 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     EXPECT_NEAR(expected_bias, accum_bias, error_margin);
   }
 
+  // Check that the fused CPU updates reach the same parameters and history
+  // as the step-by-step ones, with both kinds of regularization.
+  void CheckFusedUpdate(const Dtype kLearningRate, const Dtype kWeightDecay,
+      const Dtype kMomentum, const int kNumIters, const int kIterSize = 1) {
+    if (Caffe::mode() != Caffe::CPU) { return; }
+    const double kPrecision = 1e-4;
+    const double kMinPrecision = 1e-7;
+    const char* kRegularizationTypes[] = {"L2", "L1"};
+    for (int r = 0; r < 2; ++r) {
+      regularization_type_ = kRegularizationTypes[r];
+      vector<shared_ptr<Blob<Dtype> > > expected;
+      for (int fused = 0; fused <= 1; ++fused) {
+        fused_update_ = fused;
+        this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+            kNumIters, kIterSize);
+        vector<Blob<Dtype>*> blobs = solver_->net()->learnable_params();
+        for (int i = 0; i < solver_->history().size(); ++i) {
+          blobs.push_back(solver_->history()[i].get());
+        }
+        if (!fused) {
+          for (int i = 0; i < blobs.size(); ++i) {
+            expected.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+            expected[i]->CopyFrom(*blobs[i], false, true);
+          }
+          continue;
+        }
+        ASSERT_EQ(expected.size(), blobs.size());
+        for (int i = 0; i < blobs.size(); ++i) {
+          for (int j = 0; j < blobs[i]->count(); ++j) {
+            const Dtype expected_value = expected[i]->cpu_data()[j];
+            const Dtype fused_value = blobs[i]->cpu_data()[j];
+            const Dtype error_margin = std::max(kMinPrecision, kPrecision *
+                std::min(fabs(expected_value), fabs(fused_value)));
+            EXPECT_NEAR(expected_value, fused_value, error_margin)
+                << regularization_type_ << " blob " << i << " at " << j;
+          }
+        }
+      }
+    }
+    fused_update_ = true;
+    regularization_type_ = "L2";
+  }
+
   // Test that the correct update is computed for a regularized least squares
   // problem:
   //
@@ -476,6 +589,11 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
       CUDA_CHECK(cudaGetDeviceCount(&available_devices));
     }
 #endif
+    // In CPU mode, data parallelism runs on solver threads, or processes
+    // around a ring, of which three make for a longer one.
+    if (Caffe::mode() == Caffe::CPU) {
+      available_devices = distributed_ ? 3 : 2;
+    }
     for (int devices = 1; devices <= available_devices; ++devices) {
       // Configure batch size for single / multi device equivalence.
       // Constant data is needed for multi device as for accumulation.
@@ -573,15 +691,36 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 };
 
 
+// An SGD solver that overrides only ComputeUpdateValue, to take half steps.
+template <typename Dtype>
+class HalfStepSGDSolver : public SGDSolver<Dtype> {
+ public:
+  explicit HalfStepSGDSolver(const SolverParameter& param)
+      : SGDSolver<Dtype>(param) {}
+
+ protected:
+  virtual void ComputeUpdateValue(int param_id, Dtype rate) {
+    SGDSolver<Dtype>::ComputeUpdateValue(param_id, rate / 2);
+  }
+};
+
 template <typename TypeParam>
 class SGDSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
 
  protected:
+  SGDSolverTest() : half_step_(false) {}
+
   virtual void InitSolver(const SolverParameter& param) {
-    this->solver_.reset(new SGDSolver<Dtype>(param));
+    if (half_step_) {
+      this->solver_.reset(new HalfStepSGDSolver<Dtype>(param));
+    } else {
+      this->solver_.reset(new SGDSolver<Dtype>(param));
+    }
   }
 
+  bool half_step_;
+
   virtual SolverParameter_SolverType solver_type() {
     return SolverParameter_SolverType_SGD;
   }
@@ -666,6 +805,44 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateDistributed) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->distributed_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateDistributedTCP) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->distributed_ = true;
+  this->tcp_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateDistributedShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->share_ = true;
+  this->distributed_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -689,6 +866,53 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(SGDSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(SGDSolverTest, TestFusedUpdateSubclass) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const double kPrecision = 1e-4;
+  const double kMinPrecision = 1e-7;
+  // The subclass takes its own steps although fused_update is set, so it
+  // trains as SGD does with half the learning rate.
+  this->half_step_ = true;
+  this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+      kNumIters);
+  vector<shared_ptr<Blob<Dtype> > > half_step_params;
+  const vector<Blob<Dtype>*>& params = this->solver_->net()->learnable_params();
+  for (int i = 0; i < params.size(); ++i) {
+    half_step_params.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    half_step_params[i]->CopyFrom(*params[i], false, true);
+  }
+  this->half_step_ = false;
+  this->RunLeastSquaresSolver(kLearningRate / 2, kWeightDecay, kMomentum,
+      kNumIters);
+  const vector<Blob<Dtype>*>& expected_params =
+      this->solver_->net()->learnable_params();
+  ASSERT_EQ(expected_params.size(), half_step_params.size());
+  for (int i = 0; i < expected_params.size(); ++i) {
+    for (int j = 0; j < expected_params[i]->count(); ++j) {
+      const Dtype expected_value = expected_params[i]->cpu_data()[j];
+      const Dtype half_step_value = half_step_params[i]->cpu_data()[j];
+      const Dtype error_margin = std::max(kMinPrecision, kPrecision *
+          std::min(fabs(expected_value), fabs(half_step_value)));
+      EXPECT_NEAR(expected_value, half_step_value, error_margin);
+    }
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -792,6 +1016,17 @@ TYPED_TEST(AdaGradSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(AdaGradSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 TYPED_TEST(AdaGradSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -929,6 +1164,17 @@ TYPED_TEST(NesterovSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(NesterovSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 TYPED_TEST(NesterovSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1062,6 +1308,17 @@ TYPED_TEST(AdaDeltaSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(AdaDeltaSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.95;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 TYPED_TEST(AdaDeltaSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.1;
@@ -1167,6 +1424,17 @@ TYPED_TEST(AdamSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(AdamSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 TYPED_TEST(AdamSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1273,6 +1541,17 @@ TYPED_TEST(RMSPropSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(RMSPropSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 TYPED_TEST(RMSPropSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -0,0 +1,142 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/im2col.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Reference im2col: one bounds check per column entry.
+template <typename Dtype>
+void reference_im2col(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    Dtype* data_col) {
+  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  int channels_col = channels * kernel_h * kernel_w;
+  for (int c = 0; c < channels_col; ++c) {
+    int w_offset = c % kernel_w;
+    int h_offset = (c / kernel_w) % kernel_h;
+    int c_im = c / kernel_h / kernel_w;
+    for (int h = 0; h < height_col; ++h) {
+      for (int w = 0; w < width_col; ++w) {
+        int h_pad = h * stride_h - pad_h + h_offset;
+        int w_pad = w * stride_w - pad_w + w_offset;
+        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
+          data_col[(c * height_col + h) * width_col + w] =
+            data_im[(c_im * height + h_pad) * width + w_pad];
+        else
+          data_col[(c * height_col + h) * width_col + w] = 0;
+      }
+    }
+  }
+}
+
+// Reference col2im: zero the image, then scatter-add every column entry.
+template <typename Dtype>
+void reference_col2im(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    Dtype* data_im) {
+  for (int i = 0; i < height * width * channels; ++i) {
+    data_im[i] = 0;
+  }
+  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
+  int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
+  int channels_col = channels * patch_h * patch_w;
+  for (int c = 0; c < channels_col; ++c) {
+    int w_offset = c % patch_w;
+    int h_offset = (c / patch_w) % patch_h;
+    int c_im = c / patch_h / patch_w;
+    for (int h = 0; h < height_col; ++h) {
+      for (int w = 0; w < width_col; ++w) {
+        int h_pad = h * stride_h - pad_h + h_offset;
+        int w_pad = w * stride_w - pad_w + w_offset;
+        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
+          data_im[(c_im * height + h_pad) * width + w_pad] +=
+              data_col[(c * height_col + h) * width_col + w];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+class Im2colTest : public ::testing::Test {
+ protected:
+  // Checks im2col_cpu and col2im_cpu against the reference loops. The fast
+  // paths only reorder copies, and each image entry is summed in the same
+  // order, so the results must match exactly.
+  void CheckParity(const int channels, const int height, const int width,
+      const int kernel_h, const int kernel_w, const int pad_h,
+      const int pad_w, const int stride_h, const int stride_w) {
+    const int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+    const int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+    Blob<Dtype> image(1, channels, height, width);
+    Blob<Dtype> col(1, channels * kernel_h * kernel_w, height_col, width_col);
+    Blob<Dtype> ref_image(image.shape());
+    Blob<Dtype> ref_col(col.shape());
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&image);
+    im2col_cpu(image.cpu_data(), channels, height, width, kernel_h, kernel_w,
+        pad_h, pad_w, stride_h, stride_w, col.mutable_cpu_data());
+    reference_im2col(image.cpu_data(), channels, height, width, kernel_h,
+        kernel_w, pad_h, pad_w, stride_h, stride_w,
+        ref_col.mutable_cpu_data());
+    for (int i = 0; i < col.count(); ++i) {
+      ASSERT_EQ(ref_col.cpu_data()[i], col.cpu_data()[i])
+          << "im2col kernel " << kernel_h << "x" << kernel_w << " pad "
+          << pad_h << "," << pad_w << " stride " << stride_h << ","
+          << stride_w << " at " << i;
+    }
+    filler.Fill(&col);
+    col2im_cpu(col.cpu_data(), channels, height, width, kernel_h, kernel_w,
+        pad_h, pad_w, stride_h, stride_w, image.mutable_cpu_data());
+    reference_col2im(col.cpu_data(), channels, height, width, kernel_h,
+        kernel_w, pad_h, pad_w, stride_h, stride_w,
+        ref_image.mutable_cpu_data());
+    for (int i = 0; i < image.count(); ++i) {
+      ASSERT_EQ(ref_image.cpu_data()[i], image.cpu_data()[i])
+          << "col2im kernel " << kernel_h << "x" << kernel_w << " pad "
+          << pad_h << "," << pad_w << " stride " << stride_h << ","
+          << stride_w << " at " << i;
+    }
+  }
+};
+
+TYPED_TEST_CASE(Im2colTest, TestDtypes);
+
+TYPED_TEST(Im2colTest, TestSquareKernels) {
+  for (int kernel = 1; kernel <= 5; kernel += 2) {
+    for (int pad = 0; pad <= 2; ++pad) {
+      for (int stride = 1; stride <= 3; ++stride) {
+        this->CheckParity(3, 9, 11, kernel, kernel, pad, pad, stride, stride);
+      }
+    }
+  }
+}
+
+TYPED_TEST(Im2colTest, TestRectangularKernels) {
+  this->CheckParity(2, 7, 10, 3, 5, 1, 2, 1, 2);
+  this->CheckParity(2, 10, 7, 5, 3, 2, 0, 2, 1);
+  this->CheckParity(2, 6, 6, 1, 4, 0, 3, 3, 1);
+}
+
+TYPED_TEST(Im2colTest, TestKernelLargerThanImage) {
+  this->CheckParity(2, 3, 4, 5, 5, 2, 2, 1, 1);
+  this->CheckParity(2, 3, 4, 5, 5, 3, 3, 2, 2);
+}
+
+TYPED_TEST(Im2colTest, TestLargeImage) {
+  // Large enough for the channels to be split across threads.
+  this->CheckParity(16, 32, 32, 3, 3, 1, 1, 1, 1);
+  this->CheckParity(16, 33, 33, 3, 3, 1, 1, 2, 2);
+}
+
+}  // namespace caffe
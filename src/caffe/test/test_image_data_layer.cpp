@@ -115,6 +115,48 @@ TYPED_TEST(ImageDataLayerTest, TestResize) {
   }
 }
 
+// The batches are the same whether the images are decoded on one thread or
+// several, and read ahead or not.
+TYPED_TEST(ImageDataLayerTest, TestReadThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(3);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_new_height(32);
+  image_data_param->set_new_width(40);
+  image_data_param->set_shuffle(true);
+  TransformationParameter* transform_param = param.mutable_transform_param();
+  transform_param->set_crop_size(24);
+  transform_param->set_mirror(true);
+  vector<Dtype> expected;
+  for (int decode_threads = 1; decode_threads <= 3; decode_threads += 2) {
+    image_data_param->set_decode_threads(decode_threads);
+    image_data_param->set_readahead_batches(decode_threads - 1);
+    Caffe::set_random_seed(this->seed_);
+    ImageDataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    vector<Dtype> data;
+    for (int iter = 0; iter < 4; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      data.insert(data.end(), this->blob_top_label_->cpu_data(),
+          this->blob_top_label_->cpu_data() + 3);
+      data.insert(data.end(), this->blob_top_data_->cpu_data(),
+          this->blob_top_data_->cpu_data() + this->blob_top_data_->count());
+    }
+    if (decode_threads == 1) {
+      expected = data;
+      continue;
+    }
+    ASSERT_EQ(expected.size(), data.size());
+    for (int i = 0; i < data.size(); ++i) {
+      EXPECT_EQ(expected[i], data[i]) << "debug: threads " << decode_threads
+          << " index " << i;
+    }
+  }
+}
+
 TYPED_TEST(ImageDataLayerTest, TestReshape) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
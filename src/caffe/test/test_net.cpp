@@ -1,3 +1,4 @@
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -21,11 +22,14 @@ class NetTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
 
  protected:
-  NetTest() : seed_(1701) {}
+  NetTest() : seed_(1701), flat_params_(false) {}
 
   virtual void InitNetFromProtoString(const string& proto) {
     NetParameter param;
     CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    if (flat_params_) {
+      param.set_flat_params(true);
+    }
     net_.reset(new Net<Dtype>(param));
   }
 
@@ -713,7 +717,260 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitChannelLastNet(const bool channel_last) {
+    string proto =
+        "name: 'ChannelLastTestNetwork' "
+        "force_backward: true ";
+    if (channel_last) {
+      proto += "layout: NHWC ";
+    }
+    proto +=
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { dim: 2 dim: 3 dim: 9 dim: 9 } "
+        "    data_filler { type: 'gaussian' std: 1 } "
+        "    shape { dim: 2 dim: 5 } "
+        "    data_filler { type: 'gaussian' std: 1 } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'label' "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'pool1' "
+        "  type: 'Pooling' "
+        "  bottom: 'conv1' "
+        "  top: 'pool1' "
+        "  pooling_param { pool: MAX kernel_size: 3 stride: 2 } "
+        "} "
+        "layer { "
+        "  name: 'scale1' "
+        "  type: 'Power' "
+        "  bottom: 'pool1' "
+        "  top: 'pool1' "
+        "  power_param { scale: 2 } "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'pool1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 3 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'concat' "
+        "  type: 'Concat' "
+        "  bottom: 'pool1' "
+        "  bottom: 'conv2' "
+        "  top: 'concat' "
+        "} "
+        "layer { "
+        "  name: 'pool2' "
+        "  type: 'Pooling' "
+        "  bottom: 'concat' "
+        "  top: 'pool2' "
+        "  pooling_param { pool: AVE kernel_size: 3 stride: 2 pad: 1 } "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'pool2' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 6 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu2' "
+        "  type: 'ReLU' "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'ip1' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: 'ip' "
+        "  bottom: 'label' "
+        "  top: 'loss' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitReuseActivationsNet(const bool reuse_activations,
+      const bool parallel_forward = false) {
+    string proto =
+        "name: 'ReuseActivationsTestNetwork' "
+        "state: { phase: TEST } "
+        "input: 'data' "
+        "input_shape { dim: 2 dim: 3 dim: 10 dim: 10 } ";
+    if (reuse_activations) {
+      proto += "reuse_activations: true ";
+    }
+    if (parallel_forward) {
+      proto += "parallel_forward: true forward_threads: 3 ";
+    }
+    proto +=
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'pool1' "
+        "  type: 'Pooling' "
+        "  bottom: 'conv1' "
+        "  top: 'pool1' "
+        "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'pool1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv3' "
+        "  type: 'Convolution' "
+        "  bottom: 'pool1' "
+        "  top: 'conv3' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv2' "
+        "  bottom: 'conv3' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'flatten' "
+        "  type: 'Flatten' "
+        "  bottom: 'sum' "
+        "  top: 'flat' "
+        "} "
+        "layer { "
+        "  name: 'relu2' "
+        "  type: 'ReLU' "
+        "  bottom: 'flat' "
+        "  top: 'relu2' "
+        "} "
+        "layer { "
+        "  name: 'scale' "
+        "  type: 'Power' "
+        "  bottom: 'relu2' "
+        "  top: 'scale' "
+        "  power_param { scale: 2 } "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitRandomDataNet(const bool parallel_forward) {
+    string proto =
+        "name: 'RandomDataTestNetwork' "
+        "state: { phase: TEST } ";
+    if (parallel_forward) {
+      proto += "parallel_forward: true forward_threads: 3 ";
+    }
+    proto +=
+        "layer { "
+        "  name: 'noise1' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+        "    data_filler { type: 'gaussian' std: 1 } "
+        "  } "
+        "  top: 'noise1' "
+        "} "
+        "layer { "
+        "  name: 'conv' "
+        "  type: 'Convolution' "
+        "  bottom: 'noise1' "
+        "  top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 3 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'noise2' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+        "    data_filler { type: 'uniform' min: -1 max: 1 } "
+        "  } "
+        "  top: 'noise2' "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv' "
+        "  bottom: 'noise2' "
+        "  top: 'sum' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
   int seed_;
+  bool flat_params_;
   shared_ptr<Net<Dtype> > net_;
 };
 
@@ -2365,4 +2622,253 @@ TYPED_TEST(NetTest, TestSkipPropagateDown) {
   }
 }
 
+TYPED_TEST(NetTest, TestChannelLastLayout) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The same net in NCHW and NHWC layout must compute the same loss and the
+  // same gradients; only the order of the intermediate blobs differs.
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_random_seed(this->seed_);
+  this->InitChannelLastNet(false);
+  const Dtype loss = this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+  vector<shared_ptr<Blob<Dtype> > > params;
+  this->CopyNetParams(true, &params);
+  Blob<Dtype> data;
+  data.CopyFrom(*this->net_->blob_by_name("data"), false, true);
+  data.CopyFrom(*this->net_->blob_by_name("data"), true, true);
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitChannelLastNet(true);
+  EXPECT_TRUE(this->net_->has_blob("conv1_nhwc"));
+  EXPECT_FALSE(this->net_->has_blob("conv1"));
+  // pool1 is converted again after the in-place NCHW-only scale1, and relu2
+  // stays in NCHW on the output of an NCHW-only layer.
+  EXPECT_TRUE(this->net_->has_blob("pool1_nhwc_1"));
+  EXPECT_FALSE(this->net_->has_blob("ip1_nhwc"));
+  const Dtype channel_last_loss =
+      this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+  const Dtype kErrorMargin = 1e-4;
+  EXPECT_NEAR(loss, channel_last_loss, kErrorMargin);
+  const vector<shared_ptr<Blob<Dtype> > >& channel_last_params =
+      this->net_->params();
+  ASSERT_EQ(params.size(), channel_last_params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    ASSERT_EQ(params[i]->count(), channel_last_params[i]->count());
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_NEAR(params[i]->cpu_diff()[j],
+          channel_last_params[i]->cpu_diff()[j], kErrorMargin);
+    }
+  }
+  const Blob<Dtype>& channel_last_data = *this->net_->blob_by_name("data");
+  for (int i = 0; i < data.count(); ++i) {
+    EXPECT_EQ(data.cpu_data()[i], channel_last_data.cpu_data()[i]);
+    EXPECT_NEAR(data.cpu_diff()[i], channel_last_data.cpu_diff()[i],
+        kErrorMargin);
+  }
+}
+
+TYPED_TEST(NetTest, TestReuseActivations) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitReuseActivationsNet(false);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitReuseActivationsNet(true);
+  shared_ptr<Net<Dtype> > reuse_net = this->net_;
+  // Activations with disjoint lifetimes share memory.
+  set<SyncedMemory*> memory;
+  set<SyncedMemory*> reuse_memory;
+  for (int i = 0; i < net->blobs().size(); ++i) {
+    memory.insert(net->blobs()[i]->data().get());
+    reuse_memory.insert(reuse_net->blobs()[i]->data().get());
+  }
+  EXPECT_LT(reuse_memory.size(), memory.size());
+  // The inputs and outputs keep their own memory.
+  EXPECT_EQ(1, reuse_net->output_blobs().size());
+  for (int i = 0; i < reuse_net->blobs().size(); ++i) {
+    if (reuse_net->blob_names()[i] == "data" ||
+        reuse_net->blob_names()[i] == "scale") { continue; }
+    EXPECT_NE(reuse_net->blob_by_name("data")->data(),
+        reuse_net->blobs()[i]->data());
+    EXPECT_NE(reuse_net->blob_by_name("scale")->data(),
+        reuse_net->blobs()[i]->data());
+  }
+  // The outputs match, also after the input grows past the planned sizes.
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int size = 10; size <= 14; size += 4) {
+    Blob<Dtype> input(2, 3, size, size);
+    filler.Fill(&input);
+    vector<Blob<Dtype>*> bottom(1, &input);
+    net->input_blobs()[0]->ReshapeLike(input);
+    reuse_net->input_blobs()[0]->ReshapeLike(input);
+    const Blob<Dtype>* output = net->Forward(bottom)[0];
+    const Blob<Dtype>* reuse_output = reuse_net->Forward(bottom)[0];
+    ASSERT_EQ(output->count(), reuse_output->count());
+    for (int i = 0; i < output->count(); ++i) {
+      EXPECT_EQ(output->cpu_data()[i], reuse_output->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestParallelForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitReuseActivationsNet(false);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitReuseActivationsNet(false, true);
+  shared_ptr<Net<Dtype> > parallel_net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitReuseActivationsNet(true, true);
+  shared_ptr<Net<Dtype> > parallel_reuse_net = this->net_;
+  // conv2 and conv3 may run concurrently; the outputs match the serial pass.
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int size = 10; size <= 14; size += 4) {
+    Blob<Dtype> input(2, 3, size, size);
+    filler.Fill(&input);
+    vector<Blob<Dtype>*> bottom(1, &input);
+    net->input_blobs()[0]->ReshapeLike(input);
+    parallel_net->input_blobs()[0]->ReshapeLike(input);
+    parallel_reuse_net->input_blobs()[0]->ReshapeLike(input);
+    const Blob<Dtype>* output = net->Forward(bottom)[0];
+    for (int pass = 0; pass < 3; ++pass) {
+      const Blob<Dtype>* parallel_output = parallel_net->Forward(bottom)[0];
+      const Blob<Dtype>* parallel_reuse_output =
+          parallel_reuse_net->Forward(bottom)[0];
+      ASSERT_EQ(output->count(), parallel_output->count());
+      ASSERT_EQ(output->count(), parallel_reuse_output->count());
+      for (int i = 0; i < output->count(); ++i) {
+        EXPECT_EQ(output->cpu_data()[i], parallel_output->cpu_data()[i]);
+        EXPECT_EQ(output->cpu_data()[i],
+            parallel_reuse_output->cpu_data()[i]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestParallelForwardRandom) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitRandomDataNet(false);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitRandomDataNet(true);
+  shared_ptr<Net<Dtype> > parallel_net = this->net_;
+  EXPECT_TRUE(net->layer_by_name("noise1")->ForwardOnCallingThread());
+  EXPECT_FALSE(net->layer_by_name("conv")->ForwardOnCallingThread());
+  // noise1 and noise2 are both ready at the start, yet draw the same numbers
+  // as in the serial pass.
+  vector<Blob<Dtype>*> bottom;
+  for (int pass = 0; pass < 3; ++pass) {
+    Caffe::set_random_seed(this->seed_ + pass);
+    const Blob<Dtype>* output = net->Forward(bottom)[0];
+    Caffe::set_random_seed(this->seed_ + pass);
+    const Blob<Dtype>* parallel_output = parallel_net->Forward(bottom)[0];
+    ASSERT_EQ(output->count(), parallel_output->count());
+    for (int i = 0; i < output->count(); ++i) {
+      EXPECT_EQ(output->cpu_data()[i], parallel_output->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFlatParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<Blob<Dtype>*> bottom;
+  vector<shared_ptr<Net<Dtype> > > nets;
+  for (int flat = 0; flat <= 1; ++flat) {
+    this->flat_params_ = flat;
+    Caffe::set_random_seed(this->seed_);
+    this->InitDiffDataSharedWeightsNet();
+    nets.push_back(this->net_);
+    EXPECT_EQ(flat, this->net_->has_flat_params());
+    if (flat) {
+      // The learnable params lie back to back, and sharers point into them.
+      const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+      const Dtype* data = this->net_->flat_params_cpu_data();
+      const Dtype* diff = this->net_->flat_params_cpu_diff();
+      size_t offset = 0;
+      for (int i = 0; i < params.size(); ++i) {
+        EXPECT_EQ(data + offset, params[i]->cpu_data());
+        EXPECT_EQ(diff + offset, params[i]->cpu_diff());
+        offset += params[i]->count();
+      }
+      EXPECT_EQ(offset, this->net_->flat_params_count());
+      EXPECT_EQ(this->net_->layers()[1]->blobs()[0]->cpu_data(),
+          this->net_->layers()[2]->blobs()[0]->cpu_data());
+    }
+    for (int iter = 0; iter < 2; ++iter) {
+      this->net_->ClearParamDiffs();
+      this->net_->Forward(bottom);
+      this->net_->Backward();
+      this->net_->Update();
+    }
+  }
+  // Training went the same way as with separate params.
+  const vector<Blob<Dtype>*>& params = nets[0]->learnable_params();
+  const vector<Blob<Dtype>*>& flat_params = nets[1]->learnable_params();
+  ASSERT_EQ(params.size(), flat_params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(params[i]->cpu_data()[j], flat_params[i]->cpu_data()[j]);
+      EXPECT_EQ(params[i]->cpu_diff()[j], flat_params[i]->cpu_diff()[j]);
+    }
+  }
+}
+
+// Records the layers the backward callbacks report, and the diffs of the
+// learnable params each one owns at that point.
+template <typename Dtype>
+class BackwardRecorder : public Net<Dtype>::Callback {
+ public:
+  explicit BackwardRecorder(const Net<Dtype>* net)
+      : net_(net), diffs_(net->learnable_params().size()) {}
+
+  const Net<Dtype>* net_;
+  vector<int> layer_ids_;
+  vector<vector<Dtype> > diffs_;
+
+ protected:
+  void on_backward_done(int layer_id) {
+    layer_ids_.push_back(layer_id);
+    const vector<Blob<Dtype>*>& params = net_->learnable_params();
+    for (int i = 0; i < params.size(); ++i) {
+      if (net_->learnable_param_layer_ids()[i] == layer_id) {
+        diffs_[i].assign(params[i]->cpu_diff(),
+            params[i]->cpu_diff() + params[i]->count());
+      }
+    }
+  }
+};
+
+TYPED_TEST(NetTest, TestBackwardCallbacks) {
+  typedef typename TypeParam::Dtype Dtype;
+  // innerproduct2 shares the weights of innerproduct1, so they are only final
+  // once backward is done with the owner, innerproduct1.
+  this->InitDiffDataSharedWeightsNet();
+  EXPECT_EQ(1, this->net_->learnable_param_layer_ids()[0]);
+  BackwardRecorder<Dtype> recorder(this->net_.get());
+  this->net_->add_callback(&recorder);
+  vector<Blob<Dtype>*> bottom;
+  this->net_->ClearParamDiffs();
+  this->net_->Forward(bottom);
+  this->net_->Backward();
+  // Every layer is reported once, deepest first.
+  const int num_layers = this->net_->layers().size();
+  ASSERT_EQ(num_layers, recorder.layer_ids_.size());
+  for (int i = 0; i < num_layers; ++i) {
+    EXPECT_EQ(num_layers - 1 - i, recorder.layer_ids_[i]);
+  }
+  // The diffs seen by the callbacks were the final ones.
+  const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+  for (int i = 0; i < params.size(); ++i) {
+    ASSERT_EQ(params[i]->count(), recorder.diffs_[i].size());
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(params[i]->cpu_diff()[j], recorder.diffs_[i][j]);
+    }
+  }
+}
+
 }  // namespace caffe
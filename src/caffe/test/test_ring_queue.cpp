@@ -0,0 +1,141 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/ring_queue.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class RingQueueTest : public ::testing::Test {};
+
+TEST_F(RingQueueTest, TestFIFO) {
+  RingQueue<int> queue(3);
+  EXPECT_EQ(4, queue.capacity());
+  EXPECT_EQ(2, RingQueue<int>(1).capacity());
+  EXPECT_EQ(2, RingQueue<int>(0).capacity());
+  int t;
+  EXPECT_FALSE(queue.try_pop(&t));
+  EXPECT_FALSE(queue.try_peek(&t));
+  // Go around the ring a few times.
+  for (int i = 0; i < 10; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      queue.push(i * 3 + j);
+    }
+    EXPECT_EQ(3, queue.size());
+    EXPECT_EQ(i * 3, queue.peek());
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_EQ(i * 3 + j, queue.pop());
+    }
+    EXPECT_EQ(0, queue.size());
+  }
+  EXPECT_EQ(0, queue.pop_waits());
+  EXPECT_EQ(0, queue.push_waits());
+}
+
+TEST_F(RingQueueTest, TestFull) {
+  RingQueue<int> queue(2);
+  EXPECT_TRUE(queue.try_push(1));
+  EXPECT_TRUE(queue.try_push(2));
+  EXPECT_FALSE(queue.try_push(3));
+  EXPECT_EQ(2, queue.size());
+  int t;
+  EXPECT_TRUE(queue.try_pop(&t));
+  EXPECT_EQ(1, t);
+  EXPECT_TRUE(queue.try_push(3));
+}
+
+static void Produce(RingQueue<int>* queue, int first, int count) {
+  for (int i = first; i < first + count; ++i) {
+    queue->push(i);
+  }
+}
+
+static void Consume(RingQueue<int>* queue, int count, vector<int>* seen) {
+  for (int i = 0; i < count; ++i) {
+    ++(*seen)[queue->pop()];
+  }
+}
+
+// Several producers and consumers through a small queue, parking on it.
+TEST_F(RingQueueTest, TestThreads) {
+  const int num_threads = 3;
+  const int count = 10000;
+  for (int spin_count = 0; spin_count <= 10; spin_count += 10) {
+    RingQueue<int> queue(4, spin_count);
+    vector<vector<int> > seen(num_threads,
+        vector<int>(num_threads * count, 0));
+    boost::thread_group threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.create_thread(boost::bind(&Consume, &queue, count, &seen[i]));
+      threads.create_thread(boost::bind(&Produce, &queue, i * count, count));
+    }
+    threads.join_all();
+    for (int j = 0; j < num_threads * count; ++j) {
+      int times = 0;
+      for (int i = 0; i < num_threads; ++i) {
+        times += seen[i][j];
+      }
+      EXPECT_EQ(1, times) << "item " << j;
+    }
+    EXPECT_EQ(0, queue.size());
+  }
+}
+
+static void Pop(RingQueue<int>* queue, int* t) {
+  *t = queue->pop();
+}
+
+TEST_F(RingQueueTest, TestWaitCounters) {
+  RingQueue<int> queue(2);
+  // The consumer starts on an empty queue.
+  int t = -1;
+  boost::thread consumer(boost::bind(&Pop, &queue, &t));
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+  queue.push(1);
+  consumer.join();
+  EXPECT_EQ(1, t);
+  EXPECT_EQ(1, queue.pop_waits());
+  EXPECT_GE(queue.pop_wait_time(), 25);
+  EXPECT_EQ(0, queue.push_waits());
+  // The producer starts on a full queue.
+  queue.push(2);
+  queue.push(3);
+  boost::thread producer(boost::bind(&Produce, &queue, 4, 1));
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+  EXPECT_EQ(2, queue.pop());
+  producer.join();
+  EXPECT_EQ(3, queue.pop());
+  EXPECT_EQ(4, queue.pop());
+  EXPECT_EQ(1, queue.push_waits());
+  EXPECT_GE(queue.push_wait_time(), 25);
+  EXPECT_EQ(1, queue.pop_waits());
+}
+
+// pop() blocks like BlockingQueue::pop(), and can be interrupted.
+static void PopForever(RingQueue<int>* queue, bool* interrupted) {
+  try {
+    queue->pop();
+  } catch (boost::thread_interrupted&) {
+    *interrupted = true;
+  }
+}
+
+TEST_F(RingQueueTest, TestInterrupt) {
+  RingQueue<int> queue(2);
+  bool interrupted = false;
+  boost::thread thread(boost::bind(&PopForever, &queue, &interrupted));
+  boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+  thread.interrupt();
+  thread.join();
+  EXPECT_TRUE(interrupted);
+  // The queue still works afterwards.
+  queue.push(1);
+  EXPECT_EQ(1, queue.pop());
+}
+
+}  // namespace caffe
@@ -0,0 +1,204 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/fast_rcnn_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// The ROIs of every image of the test roidb: label, overlap, x1, y1, x2, y2
+// and four regression targets. The first two are foreground, the next three
+// background and the last one neither.
+static const int kNumROIs = 6;
+static const float kROIs[kNumROIs][10] = {
+  {3, 0.9, 10, 20, 110, 220, 0.1, 0.2, 0.3, 0.4},
+  {5, 0.6, 200, 40, 300, 140, -0.1, 0.5, -0.2, 0.6},
+  {2, 0.3, 0, 0, 50, 50, 0, 0, 0, 0},
+  {4, 0.2, 100, 100, 400, 300, 0, 0, 0, 0},
+  {1, 0.1, 300, 200, 479, 359, 0, 0, 0, 0},
+  {1, 0.05, 20, 20, 30, 30, 0, 0, 0, 0},
+};
+
+template <typename TypeParam>
+class ROIDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  ROIDataLayerTest()
+      : seed_(1701),
+        num_classes_(6),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_rois_(new Blob<Dtype>()),
+        blob_top_labels_(new Blob<Dtype>()),
+        blob_top_bbox_targets_(new Blob<Dtype>()),
+        blob_top_bbox_weights_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_rois_);
+    blob_top_vec_.push_back(blob_top_labels_);
+    blob_top_vec_.push_back(blob_top_bbox_targets_);
+    blob_top_vec_.push_back(blob_top_bbox_weights_);
+    Caffe::set_random_seed(seed_);
+    // Create the test roidb: three copies of the 480x360 cat image.
+    MakeTempFilename(&filename_);
+    std::ofstream outfile(filename_.c_str(), std::ofstream::out);
+    LOG(INFO) << "Using temporary file " << filename_;
+    for (int i = 0; i < 3; ++i) {
+      outfile << "# " << i << "\n" << EXAMPLES_SOURCE_DIR "images/cat.jpg\n"
+          << kNumROIs << "\n";
+      for (int j = 0; j < kNumROIs; ++j) {
+        for (int k = 0; k < 10; ++k) {
+          outfile << kROIs[j][k] << " ";
+        }
+        outfile << "\n";
+      }
+    }
+    outfile.close();
+  }
+
+  virtual ~ROIDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_rois_;
+    delete blob_top_labels_;
+    delete blob_top_bbox_targets_;
+    delete blob_top_bbox_weights_;
+  }
+
+  void FillParam(LayerParameter* param) {
+    ROIDataParameter* roi_data_param = param->mutable_roi_data_param();
+    roi_data_param->set_source(filename_.c_str());
+    roi_data_param->set_ims_per_batch(2);
+    roi_data_param->set_batch_size(8);
+    roi_data_param->set_num_classes(num_classes_);
+  }
+
+  // Checks that every sampled ROI is one of kROIs, scaled by im_scale and
+  // possibly mirrored, with its label and targets, and that each image has
+  // one foreground and three background ROIs.
+  void CheckROIs(const Dtype im_scale, const bool allow_mirror) {
+    const int width = 480;
+    ASSERT_EQ(8, this->blob_top_rois_->num());
+    ASSERT_EQ(5, this->blob_top_rois_->channels());
+    ASSERT_EQ(8, this->blob_top_labels_->count());
+    ASSERT_EQ(8, this->blob_top_bbox_targets_->num());
+    ASSERT_EQ(4 * num_classes_, this->blob_top_bbox_targets_->channels());
+    ASSERT_EQ(8, this->blob_top_bbox_weights_->num());
+    const Dtype* rois = this->blob_top_rois_->cpu_data();
+    const Dtype* labels = this->blob_top_labels_->cpu_data();
+    const Dtype* targets = this->blob_top_bbox_targets_->cpu_data();
+    const Dtype* weights = this->blob_top_bbox_weights_->cpu_data();
+    int num_fg[2] = {0, 0};
+    for (int i = 0; i < 8; ++i) {
+      const Dtype* roi = rois + i * 5;
+      EXPECT_EQ(i / 4, roi[0]);
+      int match = -1;
+      bool mirrored = false;
+      for (int j = 0; j < kNumROIs - 1; ++j) {
+        if (std::abs(roi[2] - kROIs[j][3] * im_scale) > 1e-3 ||
+            std::abs(roi[4] - kROIs[j][5] * im_scale) > 1e-3) {
+          continue;
+        }
+        if (std::abs(roi[1] - kROIs[j][2] * im_scale) < 1e-3 &&
+            std::abs(roi[3] - kROIs[j][4] * im_scale) < 1e-3) {
+          match = j;
+        } else if (allow_mirror &&
+            std::abs(roi[1] - (width - kROIs[j][4] - 1) * im_scale) < 1e-3 &&
+            std::abs(roi[3] - (width - kROIs[j][2] - 1) * im_scale) < 1e-3) {
+          match = j;
+          mirrored = true;
+        }
+      }
+      ASSERT_GE(match, 0) << "ROI " << i << " is not in the roidb";
+      const int label = match < 2 ? kROIs[match][0] : 0;
+      EXPECT_EQ(label, labels[i]);
+      num_fg[i / 4] += label > 0;
+      for (int k = 0; k < 4 * num_classes_; ++k) {
+        const bool is_target = label > 0 && k / 4 == label;
+        Dtype target = is_target ? kROIs[match][6 + k % 4] : 0;
+        if (mirrored && k % 4 == 0) {
+          target = -target;
+        }
+        EXPECT_NEAR(target, targets[i * 4 * num_classes_ + k], 1e-6);
+        EXPECT_EQ(is_target ? 1 : 0, weights[i * 4 * num_classes_ + k]);
+      }
+    }
+    EXPECT_EQ(1, num_fg[0]);
+    EXPECT_EQ(1, num_fg[1]);
+  }
+
+  int seed_;
+  int num_classes_;
+  string filename_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_rois_;
+  Blob<Dtype>* const blob_top_labels_;
+  Blob<Dtype>* const blob_top_bbox_targets_;
+  Blob<Dtype>* const blob_top_bbox_weights_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(ROIDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(ROIDataLayerTest, TestRead) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  this->FillParam(&param);
+  param.mutable_roi_data_param()->add_scales(180);
+  param.mutable_transform_param()->add_mean_value(100);
+  ROIDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Go through the data twice, across the end of the epoch.
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(2, this->blob_top_data_->num());
+    EXPECT_EQ(3, this->blob_top_data_->channels());
+    EXPECT_EQ(180, this->blob_top_data_->height());
+    EXPECT_EQ(240, this->blob_top_data_->width());
+    for (int i = 0; i < this->blob_top_data_->count(); ++i) {
+      EXPECT_GE(this->blob_top_data_->cpu_data()[i], -100);
+      EXPECT_LE(this->blob_top_data_->cpu_data()[i], 155);
+    }
+    this->CheckROIs(0.5, false);
+  }
+}
+
+TYPED_TEST(ROIDataLayerTest, TestMaxSize) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  this->FillParam(&param);
+  param.mutable_roi_data_param()->set_max_size(400);
+  ROIDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Set up for the largest batch, with landscape and portrait images.
+  EXPECT_EQ(400, this->blob_top_data_->height());
+  EXPECT_EQ(400, this->blob_top_data_->width());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The default scale of 600 would make the longer side 800.
+  EXPECT_EQ(300, this->blob_top_data_->height());
+  EXPECT_EQ(400, this->blob_top_data_->width());
+  this->CheckROIs(Dtype(400) / 480, false);
+}
+
+TYPED_TEST(ROIDataLayerTest, TestMirror) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  this->FillParam(&param);
+  param.mutable_roi_data_param()->add_scales(360);
+  param.mutable_transform_param()->set_mirror(true);
+  ROIDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int iter = 0; iter < 4; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->CheckROIs(1, true);
+  }
+}
+
+}  // namespace caffe
@@ -25,8 +25,6 @@ using boost::scoped_ptr;
 
 namespace caffe {
 
-typedef ::testing::Types<GPUDevice<float>, GPUDevice<double> > TestDtypesGPU;
-
 template <typename TypeParam>
 class ROIPoolingLayerTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -85,7 +83,7 @@ class ROIPoolingLayerTest : public MultiDeviceTest<TypeParam> {
   vector<Blob<Dtype>*> blob_top_vec_;
 };
 
-TYPED_TEST_CASE(ROIPoolingLayerTest, TestDtypesGPU);
+TYPED_TEST_CASE(ROIPoolingLayerTest, TestDtypesAndDevices);
 
 TYPED_TEST(ROIPoolingLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
@@ -100,4 +98,182 @@ TYPED_TEST(ROIPoolingLayerTest, TestGradient) {
       this->blob_top_vec_, 0);
 }
 
+TYPED_TEST(ROIPoolingLayerTest, TestGradientAlign) {
+  typedef typename TypeParam::Dtype Dtype;
+  // ALIGN pooling is CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  LayerParameter layer_param;
+  ROIPoolingParameter* roi_pooling_param =
+      layer_param.mutable_roi_pooling_param();
+  roi_pooling_param->set_pooled_h(3);
+  roi_pooling_param->set_pooled_w(3);
+  roi_pooling_param->set_spatial_scale(0.8);
+  roi_pooling_param->set_pool(ROIPoolingParameter_PoolMethod_ALIGN);
+  ROIPoolingLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(ROIPoolingLayerTest, TestForwardAlign) {
+  typedef typename TypeParam::Dtype Dtype;
+  // ALIGN pooling is CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  // Bilinear samples of a linear ramp along x reproduce the sample x
+  // coordinates, so each bin averages to its center x.
+  Blob<Dtype>* bottom_data = this->blob_bottom_data_;
+  for (int i = 0; i < bottom_data->count(); ++i) {
+    bottom_data->mutable_cpu_data()[i] = i % bottom_data->width();
+  }
+  Dtype* rois = this->blob_bottom_rois_->mutable_cpu_data();
+  rois[0] = 0; rois[1] = 1.5; rois[2] = 2; rois[3] = 5.5; rois[4] = 8;
+  LayerParameter layer_param;
+  ROIPoolingParameter* roi_pooling_param =
+      layer_param.mutable_roi_pooling_param();
+  roi_pooling_param->set_pooled_h(2);
+  roi_pooling_param->set_pooled_w(4);
+  roi_pooling_param->set_pool(ROIPoolingParameter_PoolMethod_ALIGN);
+  ROIPoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // ROI 0 spans x in [1.5, 5.5], so the bins are one pixel wide.
+  const Dtype* top_data = this->blob_top_data_->cpu_data();
+  for (int c = 0; c < bottom_data->channels(); ++c) {
+    for (int ph = 0; ph < 2; ++ph) {
+      for (int pw = 0; pw < 4; ++pw) {
+        EXPECT_NEAR(top_data[(c * 2 + ph) * 4 + pw], 2 + pw, 1e-5);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ROIPoolingLayerTest, TestForwardBackwardTies) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A constant input makes every element of a bin a maximum; the first one
+  // in row-major order must win and receive the whole gradient.
+  vector<Blob<Dtype>*> bottom_vec;
+  Blob<Dtype> bottom_data(1, 2, 4, 4);
+  Blob<Dtype> bottom_rois(2, 5, 1, 1);
+  caffe_set(bottom_data.count(), Dtype(3), bottom_data.mutable_cpu_data());
+  Dtype* rois = bottom_rois.mutable_cpu_data();
+  // ROI 0 covers the whole map; ROI 1 only the lower-right 2x2 corner.
+  rois[0] = 0; rois[1] = 0; rois[2] = 0; rois[3] = 3; rois[4] = 3;
+  rois[5] = 0; rois[6] = 2; rois[7] = 2; rois[8] = 3; rois[9] = 3;
+  bottom_vec.push_back(&bottom_data);
+  bottom_vec.push_back(&bottom_rois);
+  LayerParameter layer_param;
+  ROIPoolingParameter* roi_pooling_param =
+      layer_param.mutable_roi_pooling_param();
+  roi_pooling_param->set_pooled_h(2);
+  roi_pooling_param->set_pooled_w(2);
+  ROIPoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(bottom_vec, this->blob_top_vec_);
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+  const int top_count = this->blob_top_data_->count();
+  EXPECT_EQ(top_count, 2 * 2 * 2 * 2);
+  for (int i = 0; i < top_count; ++i) {
+    EXPECT_EQ(this->blob_top_data_->cpu_data()[i], 3);
+  }
+  caffe_set(top_count, Dtype(1), this->blob_top_data_->mutable_cpu_diff());
+  vector<bool> propagate_down(2, false);
+  propagate_down[0] = true;
+  layer.Backward(this->blob_top_vec_, propagate_down, bottom_vec);
+  // ROI 0 routes to the top-left of each quadrant: (0,0) (0,2) (2,0) (2,2);
+  // ROI 1 routes to each element of its 2x2 corner, adding to (2,2).
+  const Dtype expected[16] = {1, 0, 1, 0,
+                              0, 0, 0, 0,
+                              1, 0, 2, 1,
+                              0, 0, 1, 1};
+  for (int c = 0; c < 2; ++c) {
+    for (int i = 0; i < 16; ++i) {
+      EXPECT_EQ(bottom_data.cpu_diff()[c * 16 + i], expected[i]);
+    }
+  }
+}
+
+TYPED_TEST(ROIPoolingLayerTest, TestChannelLast) {
+  typedef typename TypeParam::Dtype Dtype;
+  // NHWC pooling of the transposed features gives the transposed results of
+  // NCHW pooling, in both modes and in both passes. Both are CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  const int num = this->blob_bottom_data_->num();
+  const int channels = this->blob_bottom_data_->channels();
+  const int height = this->blob_bottom_data_->height();
+  const int width = this->blob_bottom_data_->width();
+  Blob<Dtype> bottom_nhwc(num, channels, height, width);
+  for (int n = 0; n < num; ++n) {
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < height; ++h) {
+        for (int w = 0; w < width; ++w) {
+          bottom_nhwc.mutable_cpu_data()[
+              ((n * height + h) * width + w) * channels + c] =
+              this->blob_bottom_data_->data_at(n, c, h, w);
+        }
+      }
+    }
+  }
+  Blob<Dtype> top_nhwc;
+  vector<Blob<Dtype>*> bottom_nhwc_vec;
+  bottom_nhwc_vec.push_back(&bottom_nhwc);
+  bottom_nhwc_vec.push_back(this->blob_bottom_rois_);
+  vector<Blob<Dtype>*> top_nhwc_vec(1, &top_nhwc);
+  const vector<bool> propagate_down(2, true);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int align = 0; align <= 1; ++align) {
+    LayerParameter layer_param;
+    ROIPoolingParameter* roi_pooling_param =
+        layer_param.mutable_roi_pooling_param();
+    roi_pooling_param->set_pooled_h(3);
+    roi_pooling_param->set_pooled_w(2);
+    if (align) {
+      roi_pooling_param->set_spatial_scale(0.8);
+      roi_pooling_param->set_pool(ROIPoolingParameter_PoolMethod_ALIGN);
+    }
+    ROIPoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    filler.Fill(this->blob_top_data_);
+    caffe_copy(this->blob_top_data_->count(), this->blob_top_data_->cpu_data(),
+        this->blob_top_data_->mutable_cpu_diff());
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+
+    layer_param.set_layout(NHWC);
+    ROIPoolingLayer<Dtype> layer_nhwc(layer_param);
+    layer_nhwc.SetUp(bottom_nhwc_vec, top_nhwc_vec);
+    layer_nhwc.Forward(bottom_nhwc_vec, top_nhwc_vec);
+    const int num_rois = top_nhwc.num();
+    const int pooled_h = top_nhwc.height();
+    const int pooled_w = top_nhwc.width();
+    for (int r = 0; r < num_rois; ++r) {
+      for (int c = 0; c < channels; ++c) {
+        for (int ph = 0; ph < pooled_h; ++ph) {
+          for (int pw = 0; pw < pooled_w; ++pw) {
+            const int index = ((r * pooled_h + ph) * pooled_w + pw) * channels
+                + c;
+            EXPECT_NEAR(this->blob_top_data_->data_at(r, c, ph, pw),
+                top_nhwc.cpu_data()[index], 1e-5);
+            top_nhwc.mutable_cpu_diff()[index] =
+                this->blob_top_data_->diff_at(r, c, ph, pw);
+          }
+        }
+      }
+    }
+    layer_nhwc.Backward(top_nhwc_vec, propagate_down, bottom_nhwc_vec);
+    for (int n = 0; n < num; ++n) {
+      for (int c = 0; c < channels; ++c) {
+        for (int h = 0; h < height; ++h) {
+          for (int w = 0; w < width; ++w) {
+            EXPECT_NEAR(this->blob_bottom_data_->diff_at(n, c, h, w),
+                bottom_nhwc.cpu_diff()[
+                    ((n * height + h) * width + w) * channels + c], 1e-5);
+          }
+        }
+      }
+    }
+  }
+}
+
 }  // namespace caffe
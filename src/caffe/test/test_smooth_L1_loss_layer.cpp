@@ -16,8 +16,6 @@
 
 namespace caffe {
 
-typedef ::testing::Types<GPUDevice<float>, GPUDevice<double> > TestDtypesGPU;
-
 template <typename TypeParam>
 class SmoothL1LossLayerTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -67,7 +65,33 @@ class SmoothL1LossLayerTest : public MultiDeviceTest<TypeParam> {
   vector<Blob<Dtype>*> blob_top_vec_;
 };
 
-TYPED_TEST_CASE(SmoothL1LossLayerTest, TestDtypesGPU);
+TYPED_TEST_CASE(SmoothL1LossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(SmoothL1LossLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  const Dtype sigma = 2.4;
+  layer_param.mutable_smooth_l1_loss_param()->set_sigma(sigma);
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype loss = this->blob_top_loss_->cpu_data()[0];
+  // compute the loss elementwise from its definition
+  const Dtype sigma2 = sigma * sigma;
+  const int count = this->blob_bottom_data_->count();
+  Dtype expected_loss = 0;
+  for (int i = 0; i < count; ++i) {
+    const Dtype val = this->blob_bottom_inside_weights_->cpu_data()[i] *
+        (this->blob_bottom_data_->cpu_data()[i] -
+         this->blob_bottom_label_->cpu_data()[i]);
+    const Dtype abs_val = fabs(val);
+    const Dtype error = (abs_val < 1. / sigma2) ?
+        0.5 * val * val * sigma2 : abs_val - 0.5 / sigma2;
+    expected_loss += this->blob_bottom_outside_weights_->cpu_data()[i] * error;
+  }
+  expected_loss /= this->blob_bottom_data_->num();
+  EXPECT_NEAR(expected_loss, loss, 1e-5 * fabs(expected_loss) + 1e-6);
+}
 
 TYPED_TEST(SmoothL1LossLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
@@ -51,6 +51,20 @@ TEST_F(SyncedMemoryTest, TestAllocationGPU) {
 
 #endif
 
+TEST_F(SyncedMemoryTest, TestVersion) {
+  SyncedMemory mem(10);
+  const size_t initial = mem.version();
+  mem.cpu_data();
+  EXPECT_EQ(initial, mem.version());
+  mem.mutable_cpu_data();
+  EXPECT_EQ(initial + 1, mem.version());
+  mem.cpu_data();
+  EXPECT_EQ(initial + 1, mem.version());
+  char data[10];
+  mem.set_cpu_data(data);
+  EXPECT_EQ(initial + 2, mem.version());
+}
+
 TEST_F(SyncedMemoryTest, TestCPUWrite) {
   SyncedMemory mem(10);
   void* cpu_data = mem.mutable_cpu_data();
@@ -0,0 +1,230 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "opencv2/core/core.hpp"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Exposes the decoded image cache of a WindowDataLayer.
+template <typename Dtype>
+class CacheWindowDataLayer : public WindowDataLayer<Dtype> {
+ public:
+  explicit CacheWindowDataLayer(const LayerParameter& param)
+      : WindowDataLayer<Dtype>(param) {}
+  cv::Mat LoadImage(int image_index) {
+    return WindowDataLayer<Dtype>::LoadImage(image_index);
+  }
+  bool cached(int image_index) const {
+    return this->decoded_cache_index_.count(image_index) > 0;
+  }
+  size_t cache_bytes() const { return this->decoded_cache_bytes_; }
+  int hits() const { return this->decoded_cache_hits_; }
+  int misses() const { return this->decoded_cache_misses_; }
+};
+
+template <typename TypeParam>
+class WindowDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  WindowDataLayerTest()
+      : seed_(1701),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    // Create a window file with foreground and background windows in three
+    // images, the last one being the first again.
+    MakeTempFilename(&filename_);
+    std::ofstream outfile(filename_.c_str(), std::ofstream::out);
+    LOG(INFO) << "Using temporary file " << filename_;
+    outfile << "# 0\n" << EXAMPLES_SOURCE_DIR "images/cat.jpg\n"
+        << "3 360 480\n4\n"
+        << "1 0.8 10 10 200 200\n"
+        << "2 0.9 50 60 300 250\n"
+        << "0 0.1 0 0 100 100\n"
+        << "0 0.2 100 100 479 359\n";
+    outfile << "# 1\n" << EXAMPLES_SOURCE_DIR "images/fish-bike.jpg\n"
+        << "3 323 481\n3\n"
+        << "3 0.7 20 30 400 300\n"
+        << "0 0.3 0 0 240 160\n"
+        << "0 0.0 200 100 480 322\n";
+    outfile << "# 2\n" << EXAMPLES_SOURCE_DIR "images/cat.jpg\n"
+        << "3 360 480\n2\n"
+        << "1 0.6 0 0 479 359\n"
+        << "0 0.4 30 30 130 130\n";
+    outfile.close();
+  }
+
+  virtual ~WindowDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  void SetParam(LayerParameter* param, int num_workers) {
+    WindowDataParameter* window_data_param =
+        param->mutable_window_data_param();
+    window_data_param->set_source(filename_.c_str());
+    window_data_param->set_batch_size(8);
+    window_data_param->set_context_pad(2);
+    window_data_param->set_num_workers(num_workers);
+    TransformationParameter* transform_param =
+        param->mutable_transform_param();
+    transform_param->set_crop_size(16);
+    transform_param->set_mirror(true);
+  }
+
+  // Runs a layer with the given parameter for num_batches batches from the
+  // fixed seed, and appends copies of the batches to data and labels.
+  void LoadBatches(const LayerParameter& param, int num_batches,
+      vector<shared_ptr<Blob<Dtype> > >* data,
+      vector<shared_ptr<Blob<Dtype> > >* labels) {
+    Caffe::set_random_seed(seed_);
+    WindowDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    for (int iter = 0; iter < num_batches; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      data->push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      data->back()->CopyFrom(*blob_top_data_, false, true);
+      labels->push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      labels->back()->CopyFrom(*blob_top_label_, false, true);
+    }
+  }
+
+  // Checks the batches of a layer with the given parameter are the same as
+  // expected_data and expected_labels.
+  void CheckBatches(const LayerParameter& param,
+      const vector<shared_ptr<Blob<Dtype> > >& expected_data,
+      const vector<shared_ptr<Blob<Dtype> > >& expected_labels) {
+    vector<shared_ptr<Blob<Dtype> > > data;
+    vector<shared_ptr<Blob<Dtype> > > labels;
+    LoadBatches(param, expected_data.size(), &data, &labels);
+    for (int iter = 0; iter < data.size(); ++iter) {
+      ASSERT_EQ(expected_data[iter]->count(), data[iter]->count());
+      for (int i = 0; i < data[iter]->count(); ++i) {
+        EXPECT_EQ(expected_data[iter]->cpu_data()[i],
+            data[iter]->cpu_data()[i]) << "batch " << iter << " at " << i;
+      }
+      for (int i = 0; i < labels[iter]->count(); ++i) {
+        EXPECT_EQ(expected_labels[iter]->cpu_data()[i],
+            labels[iter]->cpu_data()[i]) << "batch " << iter << " at " << i;
+      }
+    }
+  }
+
+  int seed_;
+  string filename_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(WindowDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(WindowDataLayerTest, TestRead) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  this->SetParam(&param, 1);
+  WindowDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 8);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3);
+  EXPECT_EQ(this->blob_top_data_->height(), 16);
+  EXPECT_EQ(this->blob_top_data_->width(), 16);
+  EXPECT_EQ(this->blob_top_label_->num(), 8);
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // The batch holds the background windows first, then the foreground
+    // ones.
+    for (int i = 0; i < 6; ++i) {
+      EXPECT_EQ(0, this->blob_top_label_->cpu_data()[i]);
+    }
+    for (int i = 6; i < 8; ++i) {
+      EXPECT_GT(this->blob_top_label_->cpu_data()[i], 0);
+    }
+  }
+}
+
+TYPED_TEST(WindowDataLayerTest, TestWorkers) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The windows and mirrors do not depend on the number of workers.
+  LayerParameter param;
+  this->SetParam(&param, 1);
+  vector<shared_ptr<Blob<Dtype> > > data;
+  vector<shared_ptr<Blob<Dtype> > > labels;
+  this->LoadBatches(param, 3, &data, &labels);
+  for (int num_workers = 2; num_workers <= 3; ++num_workers) {
+    this->SetParam(&param, num_workers);
+    this->CheckBatches(param, data, labels);
+  }
+}
+
+TYPED_TEST(WindowDataLayerTest, TestDecodedCache) {
+  typedef typename TypeParam::Dtype Dtype;
+  const size_t kCatBytes = 360 * 480 * 3;
+  LayerParameter param;
+  this->SetParam(&param, 1);
+  param.mutable_window_data_param()->set_decoded_cache_mb(1);
+  // Set up without the prefetch thread, which would use the cache too.
+  CacheWindowDataLayer<Dtype> layer(param);
+  layer.DataLayerSetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // An image is decoded once, then handed out from the cache.
+  cv::Mat image = layer.LoadImage(0);
+  EXPECT_EQ(0, layer.hits());
+  EXPECT_EQ(1, layer.misses());
+  cv::Mat cached_image = layer.LoadImage(0);
+  EXPECT_EQ(1, layer.hits());
+  EXPECT_EQ(1, layer.misses());
+  EXPECT_EQ(image.data, cached_image.data);
+  // The first two images fit in 1 MB, the third one evicts the least
+  // recently used one.
+  layer.LoadImage(1);
+  layer.LoadImage(0);
+  EXPECT_EQ(2, layer.hits());
+  EXPECT_EQ(2, layer.misses());
+  EXPECT_TRUE(layer.cached(1));
+  layer.LoadImage(2);
+  EXPECT_EQ(3, layer.misses());
+  EXPECT_TRUE(layer.cached(0));
+  EXPECT_FALSE(layer.cached(1));
+  EXPECT_TRUE(layer.cached(2));
+  EXPECT_EQ(2 * kCatBytes, layer.cache_bytes());
+  EXPECT_LE(layer.cache_bytes(), 1 << 20);
+  layer.LoadImage(1);
+  EXPECT_EQ(4, layer.misses());
+  EXPECT_FALSE(layer.cached(0));
+  EXPECT_LE(layer.cache_bytes(), 1 << 20);
+}
+
+TYPED_TEST(WindowDataLayerTest, TestDecodedCacheBatches) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The batches are the same with and without the cache, also when it
+  // evicts images and is shared by several workers.
+  LayerParameter param;
+  this->SetParam(&param, 1);
+  vector<shared_ptr<Blob<Dtype> > > data;
+  vector<shared_ptr<Blob<Dtype> > > labels;
+  this->LoadBatches(param, 3, &data, &labels);
+  const int kCacheMBs[] = {1, 16};
+  for (int i = 0; i < 2; ++i) {
+    param.mutable_window_data_param()->set_decoded_cache_mb(kCacheMBs[i]);
+    for (int num_workers = 1; num_workers <= 3; num_workers += 2) {
+      param.mutable_window_data_param()->set_num_workers(num_workers);
+      this->CheckBatches(param, data, labels);
+    }
+  }
+}
+
+}  // namespace caffe
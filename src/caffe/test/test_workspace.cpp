@@ -0,0 +1,50 @@
+#include <boost/thread.hpp>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/workspace.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class WorkspaceTest : public ::testing::Test {
+ protected:
+  // Other tests on this thread may have grown the workspace already.
+  virtual void SetUp() { Workspace<Dtype>::Release(); }
+  virtual void TearDown() { Workspace<Dtype>::Release(); }
+};
+
+TYPED_TEST_CASE(WorkspaceTest, TestDtypes);
+
+TYPED_TEST(WorkspaceTest, TestGrowOnly) {
+  Blob<TypeParam>* buffer = Workspace<TypeParam>::Get(10);
+  EXPECT_EQ(10, buffer->count());
+  EXPECT_EQ(buffer, Workspace<TypeParam>::Get(5));
+  EXPECT_EQ(10, buffer->count());
+  EXPECT_EQ(buffer, Workspace<TypeParam>::Get(20));
+  EXPECT_EQ(20, buffer->count());
+}
+
+template <typename Dtype>
+static void GetWorkspace(Blob<Dtype>** buffer) {
+  *buffer = Workspace<Dtype>::Get(10);
+  // Written while the other thread holds its own buffer.
+  (*buffer)->mutable_cpu_data()[0] = 2;
+}
+
+TYPED_TEST(WorkspaceTest, TestPerThread) {
+  Blob<TypeParam>* buffer = Workspace<TypeParam>::Get(10);
+  buffer->mutable_cpu_data()[0] = 1;
+  Blob<TypeParam>* thread_buffer = NULL;
+  boost::thread thread(GetWorkspace<TypeParam>, &thread_buffer);
+  thread.join();
+  EXPECT_NE(buffer, thread_buffer);
+  EXPECT_EQ(buffer, Workspace<TypeParam>::Get(10));
+  EXPECT_EQ(1, buffer->cpu_data()[0]);
+}
+
+}  // namespace caffe
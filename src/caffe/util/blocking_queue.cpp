@@ -1,9 +1,9 @@
+#include <boost/function.hpp>
 #include <boost/thread.hpp>
 #include <string>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/data_reader.hpp"
-#include "caffe/parallel.hpp"
 #include "caffe/util/blocking_queue.hpp"
 
 namespace caffe {
@@ -86,11 +86,8 @@ size_t BlockingQueue<T>::size() const {
   return queue_.size();
 }
 
-template class BlockingQueue<Batch<float>*>;
-template class BlockingQueue<Batch<double>*>;
 template class BlockingQueue<Datum*>;
 template class BlockingQueue<shared_ptr<DataReader::QueuePair> >;
-template class BlockingQueue<P2PSync<float>*>;
-template class BlockingQueue<P2PSync<double>*>;
+template class BlockingQueue<boost::function<void()> >;
 
 }  // namespace caffe
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -7,33 +8,123 @@
 
 namespace caffe {
 
-template <typename Dtype>
-void im2col_cpu(const Dtype* data_im, const int channels,
+// Below this many column entries im2col/col2im stay on the calling thread.
+static const int kIm2colMinParallelCount = 1 << 16;
+
+// Range [*w_begin, *w_end) of output columns w for which the input column
+// w * stride - pad + offset lies inside [0, width).
+static inline void im2col_valid_range(const int width, const int width_col,
+    const int pad, const int stride, const int offset, int* w_begin,
+    int* w_end) {
+  const int lo = pad - offset;
+  const int hi = width - 1 + pad - offset;
+  *w_begin = lo > 0 ? std::min((lo + stride - 1) / stride, width_col) : 0;
+  *w_end = hi >= 0 ? std::min(hi / stride + 1, width_col) : 0;
+  *w_end = std::max(*w_end, *w_begin);
+}
+
+// The row kernels take the input row shifted by the kernel offset, so that
+// column w reads data_row[w * stride + shift]. kStride is the stride when it
+// is known at compile time (1 or 2) and 0 otherwise; with stride 1 the
+// in-bounds part of a row is a single contiguous copy.
+template <typename Dtype, int kStride>
+inline void im2col_row(const Dtype* data_row, const int shift,
+    const int stride, const int width_col, const int w_begin, const int w_end,
+    Dtype* col_row) {
+  const int s = kStride > 0 ? kStride : stride;
+  for (int w = 0; w < w_begin; ++w) {
+    col_row[w] = 0;
+  }
+  if (s == 1) {
+    memcpy(col_row + w_begin, data_row + w_begin + shift,
+        sizeof(Dtype) * (w_end - w_begin));
+  } else {
+    for (int w = w_begin; w < w_end; ++w) {
+      col_row[w] = data_row[w * s + shift];
+    }
+  }
+  for (int w = w_end; w < width_col; ++w) {
+    col_row[w] = 0;
+  }
+}
+
+template <typename Dtype, int kStride>
+inline void col2im_row(const Dtype* col_row, const int shift,
+    const int stride, const int w_begin, const int w_end, Dtype* data_row) {
+  const int s = kStride > 0 ? kStride : stride;
+  for (int w = w_begin; w < w_end; ++w) {
+    data_row[w * s + shift] += col_row[w];
+  }
+}
+
+// Both directions walk one input channel at a time, so channels can go to
+// separate threads: im2col writes disjoint rows of data_col and col2im owns
+// its channel of data_im. Out-of-bounds image rows are handled once per row
+// and out-of-bounds columns once per kernel offset, leaving no bounds checks
+// in the inner loops.
+template <typename Dtype, int kStride>
+static void im2col_cpu_kernel(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
     Dtype* data_col) {
-  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
-  int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
-  int channels_col = channels * kernel_h * kernel_w;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % kernel_w;
-    int h_offset = (c / kernel_w) % kernel_h;
-    int c_im = c / kernel_h / kernel_w;
-    for (int h = 0; h < height_col; ++h) {
-      for (int w = 0; w < width_col; ++w) {
-        int h_pad = h * stride_h - pad_h + h_offset;
-        int w_pad = w * stride_w - pad_w + w_offset;
-        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_col[(c * height_col + h) * width_col + w] =
-            data_im[(c_im * height + h_pad) * width + w_pad];
-        else
-          data_col[(c * height_col + h) * width_col + w] = 0;
+  const int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  const int col_spatial_dim = height_col * width_col;
+#ifdef _OPENMP
+#pragma omp parallel for if (channels * kernel_h * kernel_w * col_spatial_dim \
+    >= kIm2colMinParallelCount)
+#endif
+  for (int c_im = 0; c_im < channels; ++c_im) {
+    const Dtype* data_channel = data_im + c_im * height * width;
+    Dtype* col = data_col + c_im * kernel_h * kernel_w * col_spatial_dim;
+    for (int h_offset = 0; h_offset < kernel_h; ++h_offset) {
+      for (int w_offset = 0; w_offset < kernel_w; ++w_offset) {
+        int w_begin, w_end;
+        im2col_valid_range(width, width_col, pad_w, stride_w, w_offset,
+            &w_begin, &w_end);
+        const int shift = w_offset - pad_w;
+        for (int h = 0; h < height_col; ++h) {
+          const int h_pad = h * stride_h - pad_h + h_offset;
+          if (h_pad >= 0 && h_pad < height) {
+            im2col_row<Dtype, kStride>(data_channel + h_pad * width, shift,
+                stride_w, width_col, w_begin, w_end, col);
+          } else {
+            memset(col, 0, sizeof(Dtype) * width_col);
+          }
+          col += width_col;
+        }
       }
     }
   }
 }
 
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_col) {
+  if (kernel_h == 1 && kernel_w == 1 && pad_h == 0 && pad_w == 0
+      && stride_h == 1 && stride_w == 1) {
+    caffe_copy(channels * height * width, data_im, data_col);
+    return;
+  }
+  switch (stride_w) {
+  case 1:
+    im2col_cpu_kernel<Dtype, 1>(data_im, channels, height, width, kernel_h,
+        kernel_w, pad_h, pad_w, stride_h, stride_w, data_col);
+    break;
+  case 2:
+    im2col_cpu_kernel<Dtype, 2>(data_im, channels, height, width, kernel_h,
+        kernel_w, pad_h, pad_w, stride_h, stride_w, data_col);
+    break;
+  default:
+    im2col_cpu_kernel<Dtype, 0>(data_im, channels, height, width, kernel_h,
+        kernel_w, pad_h, pad_w, stride_h, stride_w, data_col);
+  }
+}
+
 // Explicit instantiation
 template void im2col_cpu<float>(const float* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -44,32 +135,70 @@ template void im2col_cpu<double>(const double* data_im, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, double* data_col);
 
-template <typename Dtype>
-void col2im_cpu(const Dtype* data_col, const int channels,
+// Each image location receives its contributions in the same order as a
+// plain scatter over data_col would give them, so the sums are identical.
+template <typename Dtype, int kStride>
+static void col2im_cpu_kernel(const Dtype* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
     Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
-  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
-  int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
-  int channels_col = channels * patch_h * patch_w;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % patch_w;
-    int h_offset = (c / patch_w) % patch_h;
-    int c_im = c / patch_h / patch_w;
-    for (int h = 0; h < height_col; ++h) {
-      for (int w = 0; w < width_col; ++w) {
-        int h_pad = h * stride_h - pad_h + h_offset;
-        int w_pad = w * stride_w - pad_w + w_offset;
-        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_im[(c_im * height + h_pad) * width + w_pad] +=
-              data_col[(c * height_col + h) * width_col + w];
+  const int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
+  const int col_spatial_dim = height_col * width_col;
+#ifdef _OPENMP
+#pragma omp parallel for if (channels * patch_h * patch_w * col_spatial_dim \
+    >= kIm2colMinParallelCount)
+#endif
+  for (int c_im = 0; c_im < channels; ++c_im) {
+    Dtype* data_channel = data_im + c_im * height * width;
+    const Dtype* col = data_col + c_im * patch_h * patch_w * col_spatial_dim;
+    memset(data_channel, 0, sizeof(Dtype) * height * width);
+    for (int h_offset = 0; h_offset < patch_h; ++h_offset) {
+      for (int w_offset = 0; w_offset < patch_w; ++w_offset) {
+        int w_begin, w_end;
+        im2col_valid_range(width, width_col, pad_w, stride_w, w_offset,
+            &w_begin, &w_end);
+        const int shift = w_offset - pad_w;
+        for (int h = 0; h < height_col; ++h) {
+          const int h_pad = h * stride_h - pad_h + h_offset;
+          if (h_pad >= 0 && h_pad < height) {
+            col2im_row<Dtype, kStride>(col, shift, stride_w, w_begin, w_end,
+                data_channel + h_pad * width);
+          }
+          col += width_col;
+        }
       }
     }
   }
 }
 
+template <typename Dtype>
+void col2im_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_im) {
+  if (patch_h == 1 && patch_w == 1 && pad_h == 0 && pad_w == 0
+      && stride_h == 1 && stride_w == 1) {
+    caffe_copy(channels * height * width, data_col, data_im);
+    return;
+  }
+  switch (stride_w) {
+  case 1:
+    col2im_cpu_kernel<Dtype, 1>(data_col, channels, height, width, patch_h,
+        patch_w, pad_h, pad_w, stride_h, stride_w, data_im);
+    break;
+  case 2:
+    col2im_cpu_kernel<Dtype, 2>(data_col, channels, height, width, patch_h,
+        patch_w, pad_h, pad_w, stride_h, stride_w, data_im);
+    break;
+  default:
+    col2im_cpu_kernel<Dtype, 0>(data_col, channels, height, width, patch_h,
+        patch_w, pad_h, pad_w, stride_h, stride_w, data_im);
+  }
+}
+
 // Explicit instantiation
 template void col2im_cpu<float>(const float* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
@@ -80,4 +209,78 @@ template void col2im_cpu<double>(const double* data_col, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, double* data_im);
 
+// Channel-last im2col: data_im is height x width x channels and each row of
+// data_col, one per output location, holds the kernel_h x kernel_w x channels
+// patch, so whole channel vectors are copied at a time.
+template <typename Dtype>
+void im2col_nhwc_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_col) {
+  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  for (int h = 0; h < height_col; ++h) {
+    for (int w = 0; w < width_col; ++w) {
+      for (int h_offset = 0; h_offset < kernel_h; ++h_offset) {
+        int h_pad = h * stride_h - pad_h + h_offset;
+        for (int w_offset = 0; w_offset < kernel_w; ++w_offset) {
+          int w_pad = w * stride_w - pad_w + w_offset;
+          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
+            caffe_copy(channels, data_im + (h_pad * width + w_pad) * channels,
+                data_col);
+          else
+            caffe_set(channels, Dtype(0), data_col);
+          data_col += channels;
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void im2col_nhwc_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, float* data_col);
+template void im2col_nhwc_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, double* data_col);
+
+template <typename Dtype>
+void col2im_nhwc_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_im) {
+  caffe_set(height * width * channels, Dtype(0), data_im);
+  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
+  int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
+  for (int h = 0; h < height_col; ++h) {
+    for (int w = 0; w < width_col; ++w) {
+      for (int h_offset = 0; h_offset < patch_h; ++h_offset) {
+        int h_pad = h * stride_h - pad_h + h_offset;
+        for (int w_offset = 0; w_offset < patch_w; ++w_offset) {
+          int w_pad = w * stride_w - pad_w + w_offset;
+          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
+            caffe_axpy(channels, Dtype(1), data_col,
+                data_im + (h_pad * width + w_pad) * channels);
+          data_col += channels;
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void col2im_nhwc_cpu<float>(const float* data_col,
+    const int channels, const int height, const int width,
+    const int patch_h, const int patch_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, float* data_im);
+template void col2im_nhwc_cpu<double>(const double* data_col,
+    const int channels, const int height, const int width,
+    const int patch_h, const int patch_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, double* data_im);
+
 }  // namespace caffe
@@ -0,0 +1,171 @@
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/insert_layouts.hpp"
+
+namespace caffe {
+
+// Which copies of a blob hold its current value. Blobs that are not in the
+// map (the net inputs and everything written in NCHW order) are NCHW only.
+enum BlobCopies {
+  NCHW_ONLY = 0,
+  NHWC_ONLY = 1,
+  NCHW_AND_NHWC = 2
+};
+
+void InsertLayouts(const NetParameter& param, NetParameter* param_layout) {
+  // Initialize by copying from the input NetParameter.
+  param_layout->CopyFrom(param);
+  if (param.layout() != NHWC) {
+    return;
+  }
+  param_layout->clear_layer();
+  map<string, BlobCopies> blob_name_to_copies;
+  // Whether the channel-last copy has been read since it was last written;
+  // if not, it is a net output and has to be converted back at the end.
+  map<string, bool> blob_name_to_channel_last_used;
+  // The version of the current channel-last copy. A blob that is converted
+  // again after an NCHW-only layer changed it in place gets a new copy, as a
+  // blob may only be produced once.
+  map<string, int> blob_name_to_channel_last_version;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    bool channel_last = SupportsChannelLast(layer_param);
+    // An in-place layer may only work on a channel-last copy that no NCHW
+    // blob has been made from yet; otherwise the NCHW blob would have to be
+    // produced again to read its new value. Such layers stay in NCHW.
+    for (int j = 0; channel_last && j < layer_param.top_size() &&
+         j < layer_param.bottom_size(); ++j) {
+      if (layer_param.top(j) == layer_param.bottom(j) &&
+          blob_name_to_copies[layer_param.bottom(j)] != NHWC_ONLY) {
+        channel_last = false;
+      }
+    }
+    LayerParameter converted_layer_param(layer_param);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& blob_name = layer_param.bottom(j);
+      BlobCopies& copies = blob_name_to_copies[blob_name];
+      if (channel_last && IsChannelLastBottom(layer_param, j)) {
+        if (copies == NCHW_ONLY) {
+          map<string, int>::iterator version =
+              blob_name_to_channel_last_version.find(blob_name);
+          if (version == blob_name_to_channel_last_version.end()) {
+            blob_name_to_channel_last_version[blob_name] = 0;
+          } else {
+            ++version->second;
+          }
+          ConfigureLayoutLayer(layer_param.name(), blob_name,
+              ChannelLastBlobName(blob_name,
+                  blob_name_to_channel_last_version[blob_name]),
+              NHWC, param_layout->add_layer());
+          copies = NCHW_AND_NHWC;
+        }
+        converted_layer_param.set_bottom(j, ChannelLastBlobName(blob_name,
+            blob_name_to_channel_last_version[blob_name]));
+        blob_name_to_channel_last_used[blob_name] = true;
+      } else if (copies == NHWC_ONLY) {
+        ConfigureLayoutLayer(layer_param.name(), blob_name,
+            ChannelLastBlobName(blob_name,
+                blob_name_to_channel_last_version[blob_name]),
+            NCHW, param_layout->add_layer());
+        copies = NCHW_AND_NHWC;
+        blob_name_to_channel_last_used[blob_name] = true;
+      }
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      const string& blob_name = layer_param.top(j);
+      if (channel_last) {
+        // In-place tops keep the version of their bottom.
+        if (j >= layer_param.bottom_size() ||
+            blob_name != layer_param.bottom(j)) {
+          blob_name_to_channel_last_version[blob_name] = 0;
+        }
+        converted_layer_param.set_top(j, ChannelLastBlobName(blob_name,
+            blob_name_to_channel_last_version[blob_name]));
+        blob_name_to_copies[blob_name] = NHWC_ONLY;
+        blob_name_to_channel_last_used[blob_name] = false;
+      } else {
+        blob_name_to_copies[blob_name] = NCHW_ONLY;
+      }
+    }
+    if (channel_last) {
+      converted_layer_param.set_layout(NHWC);
+    }
+    param_layout->add_layer()->CopyFrom(converted_layer_param);
+  }
+  // Restore the usual order for the outputs of the net.
+  for (map<string, BlobCopies>::const_iterator it =
+       blob_name_to_copies.begin(); it != blob_name_to_copies.end(); ++it) {
+    if (it->second == NHWC_ONLY && !blob_name_to_channel_last_used[it->first]) {
+      ConfigureLayoutLayer("output", it->first,
+          ChannelLastBlobName(it->first,
+              blob_name_to_channel_last_version[it->first]),
+          NCHW, param_layout->add_layer());
+    }
+  }
+}
+
+bool SupportsChannelLast(const LayerParameter& layer_param) {
+  const string& type = layer_param.type();
+  if (type == "ReLU" || type == "Eltwise" || type == "ROIPooling") {
+    return true;
+  }
+  if (type == "Convolution") {
+    return layer_param.convolution_param().group() == 1;
+  }
+  if (type == "Pooling") {
+    const PoolingParameter& pool_param = layer_param.pooling_param();
+    return layer_param.top_size() == 1 &&
+        (pool_param.pool() == PoolingParameter_PoolMethod_MAX ||
+         pool_param.pool() == PoolingParameter_PoolMethod_AVE);
+  }
+  if (type == "Concat") {
+    const ConcatParameter& concat_param = layer_param.concat_param();
+    return concat_param.has_concat_dim() ? concat_param.concat_dim() == 1 :
+        concat_param.axis() == 1;
+  }
+  return false;
+}
+
+bool IsChannelLastBottom(const LayerParameter& layer_param,
+    const int bottom_idx) {
+  // The second bottom of ROIPooling holds the boxes.
+  return layer_param.type() != "ROIPooling" || bottom_idx == 0;
+}
+
+void ConfigureLayoutLayer(const string& layer_name, const string& blob_name,
+    const string& channel_last_blob_name, const DataLayout layout,
+    LayerParameter* layout_layer_param) {
+  layout_layer_param->Clear();
+  layout_layer_param->set_name(LayoutLayerName(layer_name, blob_name, layout));
+  layout_layer_param->set_type("Layout");
+  layout_layer_param->set_layout(layout);
+  if (layout == NHWC) {
+    layout_layer_param->add_bottom(blob_name);
+    layout_layer_param->add_top(channel_last_blob_name);
+  } else {
+    layout_layer_param->add_bottom(channel_last_blob_name);
+    layout_layer_param->add_top(blob_name);
+  }
+}
+
+string LayoutLayerName(const string& layer_name, const string& blob_name,
+    const DataLayout layout) {
+  ostringstream layout_layer_name;
+  layout_layer_name << blob_name << "_" << layer_name << "_to_"
+      << (layout == NHWC ? "nhwc" : "nchw");
+  return layout_layer_name.str();
+}
+
+string ChannelLastBlobName(const string& blob_name, const int version) {
+  ostringstream channel_last_blob_name;
+  channel_last_blob_name << blob_name << "_nhwc";
+  if (version > 0) {
+    channel_last_blob_name << "_" << version;
+  }
+  return channel_last_blob_name.str();
+}
+
+}  // namespace caffe
@@ -0,0 +1,267 @@
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "caffe/data_layers.hpp"
+#include "caffe/data_reader.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/ring_queue.hpp"
+
+namespace caffe {
+
+// Each cell has a sequence number telling whose turn it is: the producer
+// that claims position pos finds pos there, and the consumer that claims it
+// finds pos + 1, as in D. Vyukov's bounded MPMC queue.
+template<typename T>
+class RingQueue<T>::sync {
+ public:
+  explicit sync(size_t capacity)
+      : sequences_(new boost::atomic<size_t>[capacity]),
+        enqueue_pos_(0), dequeue_pos_(0), parked_(0),
+        pop_waits_(0), push_waits_(0), pop_wait_us_(0), push_wait_us_(0) {
+    for (size_t i = 0; i < capacity; ++i) {
+      sequences_[i].store(i, boost::memory_order_relaxed);
+    }
+  }
+
+  boost::scoped_array<boost::atomic<size_t> > sequences_;
+  boost::atomic<size_t> enqueue_pos_;
+  boost::atomic<size_t> dequeue_pos_;
+  // Threads blocked on condition_
+  boost::atomic<int> parked_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+
+  boost::atomic<size_t> pop_waits_;
+  boost::atomic<size_t> push_waits_;
+  boost::atomic<uint64_t> pop_wait_us_;
+  boost::atomic<uint64_t> push_wait_us_;
+};
+
+// Retries op until it succeeds, first spinning, then parked on the queue's
+// condition variable. Returns the time waited, in microseconds.
+template<typename Sync, typename Op>
+static uint64_t WaitFor(Sync* sync, int spin_count, const Op& op) {
+  CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < spin_count; ++i) {
+    boost::this_thread::yield();
+    if (op()) {
+      return timer.MicroSeconds();
+    }
+  }
+  // Threads changing the queue check parked_ after the change, and this
+  // one checks the queue after incrementing parked_, so either it sees the
+  // change or it gets notified.
+  sync->parked_.fetch_add(1);
+  boost::atomic_thread_fence(boost::memory_order_seq_cst);
+  try {
+    boost::mutex::scoped_lock lock(sync->mutex_);
+    while (!op()) {
+      sync->condition_.wait(lock);
+    }
+  } catch (...) {
+    sync->parked_.fetch_sub(1);
+    throw;
+  }
+  sync->parked_.fetch_sub(1);
+  return timer.MicroSeconds();
+}
+
+// At least two cells are needed to tell a full queue from an empty one, so
+// this also gives room to queues asked for no capacity, like the ones of data
+// readers created with no batch size.
+static size_t RoundUpToPowerOfTwo(size_t n) {
+  size_t power = 2;
+  while (power < n) {
+    power *= 2;
+  }
+  return power;
+}
+
+template<typename T>
+RingQueue<T>::RingQueue(size_t capacity, int spin_count)
+    : cells_(RoundUpToPowerOfTwo(capacity)),
+      spin_count_(spin_count),
+      sync_(new sync(cells_.size())) {
+  CHECK_GE(spin_count, 0);
+}
+
+template<typename T>
+bool RingQueue<T>::enqueue(const T& t) {
+  const size_t mask = cells_.size() - 1;
+  size_t pos = sync_->enqueue_pos_.load(boost::memory_order_relaxed);
+  while (true) {
+    const size_t seq =
+        sync_->sequences_[pos & mask].load(boost::memory_order_acquire);
+    const intptr_t diff = static_cast<intptr_t>(seq - pos);
+    if (diff == 0) {
+      if (sync_->enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+          boost::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;  // full
+    } else {
+      pos = sync_->enqueue_pos_.load(boost::memory_order_relaxed);
+    }
+  }
+  cells_[pos & mask] = t;
+  sync_->sequences_[pos & mask].store(pos + 1, boost::memory_order_release);
+  return true;
+}
+
+template<typename T>
+bool RingQueue<T>::dequeue(T* t) {
+  const size_t mask = cells_.size() - 1;
+  size_t pos = sync_->dequeue_pos_.load(boost::memory_order_relaxed);
+  while (true) {
+    const size_t seq =
+        sync_->sequences_[pos & mask].load(boost::memory_order_acquire);
+    const intptr_t diff = static_cast<intptr_t>(seq - (pos + 1));
+    if (diff == 0) {
+      if (sync_->dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+          boost::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;  // empty
+    } else {
+      pos = sync_->dequeue_pos_.load(boost::memory_order_relaxed);
+    }
+  }
+  *t = cells_[pos & mask];
+  cells_[pos & mask] = T();
+  sync_->sequences_[pos & mask].store(pos + mask + 1,
+      boost::memory_order_release);
+  return true;
+}
+
+template<typename T>
+bool RingQueue<T>::front(T* t) {
+  const size_t mask = cells_.size() - 1;
+  const size_t pos = sync_->dequeue_pos_.load(boost::memory_order_relaxed);
+  const size_t seq =
+      sync_->sequences_[pos & mask].load(boost::memory_order_acquire);
+  if (seq != pos + 1) {
+    return false;
+  }
+  *t = cells_[pos & mask];
+  return true;
+}
+
+template<typename T>
+void RingQueue<T>::notify() {
+  boost::atomic_thread_fence(boost::memory_order_seq_cst);
+  if (sync_->parked_.load(boost::memory_order_relaxed) > 0) {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    sync_->condition_.notify_all();
+  }
+}
+
+template<typename T>
+void RingQueue<T>::push(const T& t) {
+  if (!enqueue(t)) {
+    const uint64_t us = WaitFor(sync_.get(), spin_count_,
+        boost::bind(&RingQueue<T>::enqueue, this, boost::cref(t)));
+    sync_->push_waits_.fetch_add(1, boost::memory_order_relaxed);
+    sync_->push_wait_us_.fetch_add(us, boost::memory_order_relaxed);
+  }
+  notify();
+}
+
+template<typename T>
+bool RingQueue<T>::try_push(const T& t) {
+  if (!enqueue(t)) {
+    return false;
+  }
+  notify();
+  return true;
+}
+
+template<typename T>
+bool RingQueue<T>::try_pop(T* t) {
+  if (!dequeue(t)) {
+    return false;
+  }
+  notify();
+  return true;
+}
+
+template<typename T>
+T RingQueue<T>::pop() {
+  T t;
+  if (!dequeue(&t)) {
+    const uint64_t us = WaitFor(sync_.get(), spin_count_,
+        boost::bind(&RingQueue<T>::dequeue, this, &t));
+    sync_->pop_waits_.fetch_add(1, boost::memory_order_relaxed);
+    sync_->pop_wait_us_.fetch_add(us, boost::memory_order_relaxed);
+  }
+  notify();
+  return t;
+}
+
+template<typename T>
+bool RingQueue<T>::try_peek(T* t) {
+  return front(t);
+}
+
+template<typename T>
+T RingQueue<T>::peek() {
+  T t;
+  if (!front(&t)) {
+    const uint64_t us = WaitFor(sync_.get(), spin_count_,
+        boost::bind(&RingQueue<T>::front, this, &t));
+    sync_->pop_waits_.fetch_add(1, boost::memory_order_relaxed);
+    sync_->pop_wait_us_.fetch_add(us, boost::memory_order_relaxed);
+  }
+  return t;
+}
+
+template<typename T>
+size_t RingQueue<T>::size() const {
+  // Positions are read at slightly different times, so clamp the difference
+  const size_t dequeue_pos =
+      sync_->dequeue_pos_.load(boost::memory_order_relaxed);
+  const size_t enqueue_pos =
+      sync_->enqueue_pos_.load(boost::memory_order_relaxed);
+  const intptr_t size = static_cast<intptr_t>(enqueue_pos - dequeue_pos);
+  return std::min(static_cast<size_t>(std::max<intptr_t>(size, 0)),
+      cells_.size());
+}
+
+template<typename T>
+size_t RingQueue<T>::pop_waits() const {
+  return sync_->pop_waits_.load(boost::memory_order_relaxed);
+}
+
+template<typename T>
+double RingQueue<T>::pop_wait_time() const {
+  return sync_->pop_wait_us_.load(boost::memory_order_relaxed) / 1000.;
+}
+
+template<typename T>
+size_t RingQueue<T>::push_waits() const {
+  return sync_->push_waits_.load(boost::memory_order_relaxed);
+}
+
+template<typename T>
+double RingQueue<T>::push_wait_time() const {
+  return sync_->push_wait_us_.load(boost::memory_order_relaxed) / 1000.;
+}
+
+template class RingQueue<int>;
+template class RingQueue<Batch<float>*>;
+template class RingQueue<Batch<double>*>;
+template class RingQueue<DataReader::Record*>;
+template class RingQueue<P2PSync<float>*>;
+template class RingQueue<P2PSync<double>*>;
+template class RingQueue<CPUSync<float>*>;
+template class RingQueue<CPUSync<double>*>;
+
+}  // namespace caffe
@@ -0,0 +1,234 @@
+#include <boost/thread.hpp>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/socket.hpp"
+
+namespace caffe {
+
+static const char kUnixPrefix[] = "unix:";
+static const int kBacklog = 16;
+static const int kRetryMs = 100;
+
+static bool IsUnix(const string& address) {
+  return address.compare(0, strlen(kUnixPrefix), kUnixPrefix) == 0;
+}
+
+static void UnixAddress(const string& address, sockaddr_un* addr) {
+  const string path = address.substr(strlen(kUnixPrefix));
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  CHECK(!path.empty() && path.size() < sizeof(addr->sun_path))
+      << "Invalid Unix socket path in " << address;
+  strncpy(addr->sun_path, path.c_str(), sizeof(addr->sun_path) - 1);
+}
+
+// Resolves a host:port address, or every local interface for passive ones.
+static addrinfo* TCPAddresses(const string& address, bool passive) {
+  const size_t colon = address.rfind(':');
+  CHECK(colon != string::npos)
+      << "Expected host:port or unix:path, got " << address;
+  const string host = address.substr(0, colon);
+  const string port = address.substr(colon + 1);
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  addrinfo* result = NULL;
+  const int status = getaddrinfo(passive || host.empty() ? NULL : host.c_str(),
+      port.c_str(), &hints, &result);
+  CHECK_EQ(status, 0) << "Could not resolve " << address << ": "
+      << gai_strerror(status);
+  return result;
+}
+
+// Returns a socket connected to address, or -1 if nothing listens there yet.
+static int TryConnect(const string& address) {
+  if (IsUnix(address)) {
+    sockaddr_un addr;
+    UnixAddress(address, &addr);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK_GE(fd, 0) << "Could not create socket: " << strerror(errno);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+  addrinfo* addresses = TCPAddresses(address, false);
+  int fd = -1;
+  for (addrinfo* a = addresses; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd >= 0) {
+    // Buckets are sent whole, so do not hold their tails back
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+Socket::Socket(int fd, const string& path)
+    : fd_(fd),
+      path_(path) {
+}
+
+Socket::~Socket() {
+  close(fd_);
+  if (!path_.empty()) {
+    unlink(path_.c_str());
+  }
+}
+
+shared_ptr<Socket> Socket::Listen(const string& address) {
+  if (IsUnix(address)) {
+    sockaddr_un addr;
+    UnixAddress(address, &addr);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK_GE(fd, 0) << "Could not create socket: " << strerror(errno);
+    // Remove the socket file a previous run may have left behind
+    unlink(addr.sun_path);
+    CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+        << "Could not bind " << address << ": " << strerror(errno);
+    CHECK_EQ(listen(fd, kBacklog), 0)
+        << "Could not listen on " << address << ": " << strerror(errno);
+    return shared_ptr<Socket>(new Socket(fd, addr.sun_path));
+  }
+  addrinfo* addresses = TCPAddresses(address, true);
+  int fd = -1;
+  for (addrinfo* a = addresses; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  CHECK_GE(fd, 0) << "Could not bind " << address << ": " << strerror(errno);
+  CHECK_EQ(listen(fd, kBacklog), 0)
+      << "Could not listen on " << address << ": " << strerror(errno);
+  return shared_ptr<Socket>(new Socket(fd));
+}
+
+shared_ptr<Socket> Socket::Accept() {
+  int fd;
+  do {
+    fd = accept(fd_, NULL, NULL);
+  } while (fd < 0 && errno == EINTR);
+  CHECK_GE(fd, 0) << "Could not accept connection: " << strerror(errno);
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return shared_ptr<Socket>(new Socket(fd));
+}
+
+shared_ptr<Socket> Socket::Connect(const string& address, int timeout_ms) {
+  CPUTimer timer;
+  timer.Start();
+  int fd = TryConnect(address);
+  while (fd < 0) {
+    CHECK_LT(timer.MilliSeconds(), timeout_ms) << "Could not connect to "
+        << address << ": " << strerror(errno);
+    boost::this_thread::sleep(boost::posix_time::milliseconds(kRetryMs));
+    fd = TryConnect(address);
+  }
+  return shared_ptr<Socket>(new Socket(fd));
+}
+
+void Socket::Send(const void* data, size_t size) {
+  const char* ptr = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t sent = send(fd_, ptr, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(sent, 0) << "Could not send to peer: " << strerror(errno);
+    ptr += sent;
+    size -= sent;
+  }
+}
+
+void Socket::Receive(void* data, size_t size) {
+  char* ptr = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t received = recv(fd_, ptr, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GE(received, 0) << "Could not receive from peer: " << strerror(errno);
+    CHECK_GT(received, 0) << "Peer closed the connection";
+    ptr += received;
+    size -= received;
+  }
+}
+
+void Socket::SendReceive(Socket* to, const void* out, size_t out_size,
+    Socket* from, void* in, size_t in_size) {
+  const char* out_ptr = static_cast<const char*>(out);
+  char* in_ptr = static_cast<char*>(in);
+  while (out_size > 0 || in_size > 0) {
+    pollfd fds[2];
+    int count = 0;
+    pollfd* out_fd = NULL;
+    pollfd* in_fd = NULL;
+    if (out_size > 0) {
+      out_fd = &fds[count++];
+      out_fd->fd = to->fd_;
+      out_fd->events = POLLOUT;
+    }
+    if (in_size > 0) {
+      in_fd = &fds[count++];
+      in_fd->fd = from->fd_;
+      in_fd->events = POLLIN;
+    }
+    if (poll(fds, count, -1) < 0) {
+      CHECK_EQ(errno, EINTR) << "Could not poll peers: " << strerror(errno);
+      continue;
+    }
+    // Errors and hang-ups are reported by the calls below
+    if (out_fd && out_fd->revents) {
+      const ssize_t sent =
+          send(to->fd_, out_ptr, out_size, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (sent > 0) {
+        out_ptr += sent;
+        out_size -= sent;
+      } else {
+        CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            << "Could not send to peer: " << strerror(errno);
+      }
+    }
+    if (in_fd && in_fd->revents) {
+      const ssize_t received = recv(from->fd_, in_ptr, in_size, MSG_DONTWAIT);
+      CHECK_NE(received, 0) << "Peer closed the connection";
+      if (received > 0) {
+        in_ptr += received;
+        in_size -= received;
+      } else {
+        CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            << "Could not receive from peer: " << strerror(errno);
+      }
+    }
+  }
+}
+
+}  // namespace caffe
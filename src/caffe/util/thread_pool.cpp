@@ -0,0 +1,62 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <vector>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+ThreadPool::ThreadPool(int num_threads) {
+  CHECK_GT(num_threads, 0);
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.push_back(shared_ptr<Worker>(new Worker(&tasks_)));
+    workers_.back()->StartInternalThread();
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  // Workers blocked on an empty queue are woken by the interruption.
+  workers_.clear();
+}
+
+void ThreadPool::Enqueue(const Task& task) {
+  tasks_.push(task);
+}
+
+// Runs one task of ThreadPool::Run and wakes the caller after the last one.
+static void RunAndCountDown(const ThreadPool::Task& task, boost::mutex* mutex,
+    boost::condition_variable* condition, int* remaining) {
+  task();
+  boost::mutex::scoped_lock lock(*mutex);
+  if (--*remaining == 0) {
+    condition->notify_all();
+  }
+}
+
+void ThreadPool::Run(const vector<Task>& tasks) {
+  boost::this_thread::disable_interruption no_interruption;
+  boost::mutex mutex;
+  boost::condition_variable condition;
+  int remaining = tasks.size();
+  for (int i = 0; i < tasks.size(); ++i) {
+    Enqueue(boost::bind(&RunAndCountDown, tasks[i], &mutex, &condition,
+        &remaining));
+  }
+  boost::mutex::scoped_lock lock(mutex);
+  while (remaining > 0) {
+    condition.wait(lock);
+  }
+}
+
+void ThreadPool::Worker::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      Task task = tasks_->pop();
+      task();
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+}  // namespace caffe
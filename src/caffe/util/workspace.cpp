@@ -0,0 +1,32 @@
+#include <vector>
+
+#include "caffe/util/workspace.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+boost::thread_specific_ptr<Blob<Dtype> > Workspace<Dtype>::buffer_;
+
+template <typename Dtype>
+Blob<Dtype>* Workspace<Dtype>::Get(const int count) {
+  Blob<Dtype>* buffer = buffer_.get();
+  if (!buffer) {
+    buffer = new Blob<Dtype>();
+    buffer_.reset(buffer);
+  }
+  if (buffer->count() < count) {
+    DLOG(INFO) << "Growing the workspace to " << count * sizeof(Dtype)
+        << " bytes";
+    buffer->Reshape(vector<int>(1, count));
+  }
+  return buffer;
+}
+
+template <typename Dtype>
+void Workspace<Dtype>::Release() {
+  buffer_.reset();
+}
+
+INSTANTIATE_CLASS(Workspace);
+
+}  // namespace caffe
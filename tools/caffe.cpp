@@ -4,6 +4,8 @@ namespace bp = boost::python;
 #endif
 
 #include <glog/logging.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <cstring>
 #include <map>
@@ -29,6 +31,24 @@ DEFINE_string(gpu, "",
     "Optional; run in GPU mode on given device IDs separated by ','."
     "Use '-gpu all' to run on all available GPUs. The effective training "
     "batch size is multiplied by the number of devices.");
+DEFINE_int32(threads, 1,
+    "Optional; in CPU mode, train data-parallel on this many solver threads. "
+    "The effective training batch size is multiplied by the number of "
+    "threads.");
+DEFINE_bool(pin_threads, false,
+    "Optional; with -threads, pin each solver thread to its own range of "
+    "cores.");
+DEFINE_string(hosts, "",
+    "Optional; in CPU mode, train data-parallel with the processes at these "
+    "addresses, separated by ',' and in rank order: host:port for TCP, or "
+    "unix:path for Unix sockets. Start one process per address, each with "
+    "its -rank. The effective training batch size is multiplied by the "
+    "number of processes.");
+DEFINE_int32(rank, 0,
+    "Optional; with -hosts, the rank of this process.");
+DEFINE_int32(processes, 1,
+    "Optional; in CPU mode, train data-parallel on this many processes of "
+    "this host, spawned by this one and connected over Unix sockets.");
 DEFINE_string(solver, "",
     "The solver definition protocol buffer text file.");
 DEFINE_string(model, "",
@@ -173,9 +193,13 @@ int train() {
 
   vector<int> gpus;
   get_gpus(&gpus);
+  CHECK_GE(FLAGS_threads, 1) << "Need at least one solver thread.";
   if (gpus.size() == 0) {
     Caffe::set_mode(Caffe::CPU);
+    Caffe::set_solver_count(FLAGS_threads);
   } else {
+    CHECK_EQ(FLAGS_threads, 1) << "-threads is for CPU training; give "
+        "several devices to -gpu to train on several GPUs.";
     ostringstream s;
     for (int i = 0; i < gpus.size(); ++i) {
       s << (i ? ", " : "") << gpus[i];
@@ -188,6 +212,47 @@ int train() {
     Caffe::set_solver_count(gpus.size());
   }
 
+  // Processes training together each read their share of the data
+  vector<string> hosts;
+  if (FLAGS_hosts.size()) {
+    boost::split(hosts, FLAGS_hosts, boost::is_any_of(","));
+  }
+  CHECK_GE(FLAGS_processes, 1) << "Need at least one process.";
+  if (FLAGS_processes > 1) {
+    CHECK(hosts.empty()) << "Give either -hosts or -processes.";
+    for (int i = 0; i < FLAGS_processes; ++i) {
+      ostringstream address;
+      address << "unix:/tmp/caffe-" << getpid() << "-" << i << ".sock";
+      hosts.push_back(address.str());
+    }
+  }
+  vector<pid_t> children;
+  if (hosts.size()) {
+    CHECK_EQ(gpus.size(), 0) << "-hosts and -processes train in CPU mode.";
+    CHECK_EQ(FLAGS_threads, 1) << "-hosts and -processes cannot be combined "
+        "with -threads.";
+    for (int i = 1; i < FLAGS_processes; ++i) {
+      const pid_t pid = fork();
+      CHECK_GE(pid, 0) << "Could not spawn process " << i;
+      if (pid == 0) {
+        FLAGS_rank = i;
+        children.clear();
+        break;
+      }
+      children.push_back(pid);
+    }
+    CHECK_GE(FLAGS_rank, 0);
+    CHECK_LT(FLAGS_rank, hosts.size()) << "-rank is out of -hosts.";
+    Caffe::set_process_count(hosts.size());
+    Caffe::set_process_rank(FLAGS_rank);
+    if (FLAGS_rank > 0) {
+      // Only the first process tests and snapshots the shared weights
+      solver_param.set_test_interval(0);
+      solver_param.set_snapshot(0);
+      solver_param.set_snapshot_after_train(false);
+    }
+  }
+
   caffe::SignalHandler signal_handler(
         GetRequestedAction(FLAGS_sigint_effect),
         GetRequestedAction(FLAGS_sighup_effect));
@@ -207,10 +272,22 @@ int train() {
   if (gpus.size() > 1) {
     caffe::P2PSync<float> sync(solver, NULL, solver->param());
     sync.run(gpus);
+  } else if (FLAGS_threads > 1) {
+    caffe::CPUSync<float> sync(solver, NULL, 0);
+    sync.run(FLAGS_threads, FLAGS_pin_threads);
+  } else if (hosts.size()) {
+    caffe::SocketSync<float> sync(solver, FLAGS_rank, hosts);
+    sync.run();
   } else {
     LOG(INFO) << "Starting Optimization";
     solver->Solve();
   }
+  for (int i = 0; i < children.size(); ++i) {
+    int status;
+    CHECK_EQ(waitpid(children[i], &status, 0), children[i]);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        << "Process " << i + 1 << " failed.";
+  }
   LOG(INFO) << "Optimization Done.";
   return 0;
 }